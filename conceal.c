@@ -0,0 +1,291 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#include "conceal.h"
+#include "logger.h"
+
+#define PERIOD_MIN_HZ 500        // repeated period bounds
+#define PERIOD_MAX_HZ 50
+#define PERIOD_VOICED 0.3        // weaker correlation repeats the longest period
+#define LPC_FRAMES 1024          // predictor analysis window
+#define LPC_EXPAND 0.9999        // bandwidth expansion, keeps predictor decaying
+
+struct concealer {
+    int policy;
+    long channels;
+    long rate;
+    long done;                   // frames concealed since gap start
+
+    // repeat: last period before the gap, crossfaded into itself
+    float *period;
+    long length;
+    long phase;
+
+    // lpc: predictor and last samples per channel
+    float *coef;
+    float *state;
+};
+
+static const char *policies[] = { "none", "silence", "repeat", "lpc" };
+
+
+int conceal_policy(const char *name)
+{
+    int i;
+
+    for (i = 0; i < sizeof(policies) / sizeof(policies[0]); i++)
+        if (!strcasecmp(name, policies[i]))
+            return i;
+
+    return -1;
+}
+
+
+struct concealer *concealer_create(int policy, long channels, long rate)
+{
+    struct concealer *c = calloc(1, sizeof(struct concealer));
+
+    if (!c)
+        return NULL;
+
+    c->policy = policy;
+    c->channels = channels;
+    c->rate = rate;
+
+    c->period = malloc(CONCEAL_HISTORY * channels * sizeof(float));
+    c->coef = malloc(CONCEAL_ORDER * channels * sizeof(float));
+    c->state = malloc(CONCEAL_ORDER * channels * sizeof(float));
+
+    if (!c->period || !c->coef || !c->state) {
+        concealer_free(c);
+        return NULL;
+    }
+
+    return c;
+}
+
+
+void concealer_free(struct concealer *c)
+{
+    if (!c)
+        return;
+
+    free(c->period);
+    free(c->coef);
+    free(c->state);
+    free(c);
+}
+
+
+/*
+ * Period with the best normalized correlation of the last frames, mono
+ */
+static long pitch(struct concealer *c, const float *hist, long frames)
+{
+    long min = c->rate / PERIOD_MIN_HZ, max = c->rate / PERIOD_MAX_HZ, best = 0, window, p, k;
+    float mono[CONCEAL_HISTORY];
+    double score = PERIOD_VOICED;
+
+    if (max > frames / 2)
+        max = frames / 2;
+    window = max / 2;
+
+    for (k = 0; k < frames; k++) {
+        long ch;
+
+        for (mono[k] = 0, ch = 0; ch < c->channels; ch++)
+            mono[k] += hist[k * c->channels + ch];
+    }
+
+    for (p = min; p <= max; p++) {
+        double xy = 0, xx = 0, yy = 0;
+
+        for (k = frames - window; k < frames; k++) {
+            xy += mono[k] * mono[k - p];
+            xx += mono[k] * mono[k];
+            yy += mono[k - p] * mono[k - p];
+        }
+
+        if (xx > 0 && yy > 0 && xy / sqrt(xx * yy) > score) {
+            score = xy / sqrt(xx * yy);
+            best = p;
+        }
+    }
+
+    // noise-like or too short history, longest period is least buzzy
+    return best ? best : max;
+}
+
+
+/*
+ * Levinson-Durbin recursion, a[0] = 1 implied: x[n] = -sum a[k] x[n - k]
+ */
+static void levinson(const double *r, float *coef)
+{
+    double a[CONCEAL_ORDER + 1] = { 1 }, t[CONCEAL_ORDER + 1], err = r[0], g = 1;
+    int i, j;
+
+    for (i = 1; i <= CONCEAL_ORDER && err > 0; i++) {
+        double k = r[i];
+
+        for (j = 1; j < i; j++)
+            k += a[j] * r[i - j];
+
+        k = -k / err;
+
+        memcpy(t, a, sizeof(a));
+        for (j = 1; j < i; j++)
+            a[j] = t[j] + k * t[i - j];
+        a[i] = k;
+
+        err *= 1 - k * k;
+    }
+
+    for (i = 1; i <= CONCEAL_ORDER; i++) {
+        g *= LPC_EXPAND;
+        coef[i - 1] = (float) (a[i] * g);
+    }
+}
+
+
+static void lpc(struct concealer *c, const float *hist, long frames)
+{
+    long n = frames < LPC_FRAMES ? frames : LPC_FRAMES, ch, k, i;
+    const float *x = hist + (frames - n) * c->channels;
+    float w[LPC_FRAMES], y[LPC_FRAMES];
+
+    for (k = 0; k < n; k++)
+        w[k] = 0.5f - 0.5f * cosf(2 * M_PI * k / n);
+
+    for (ch = 0; ch < c->channels; ch++) {
+        double r[CONCEAL_ORDER + 1];
+
+        // autocorrelation of hann windowed history
+        for (k = 0; k < n; k++)
+            y[k] = x[k * c->channels + ch] * w[k];
+
+        for (i = 0; i <= CONCEAL_ORDER; i++) {
+            r[i] = 0;
+            for (k = i; k < n; k++)
+                r[i] += (double) y[k] * y[k - i];
+        }
+
+        // white noise floor keeps the recursion well conditioned
+        r[0] *= 1.000001;
+
+        if (r[0] > 0)
+            levinson(r, c->coef + ch * CONCEAL_ORDER);
+        else
+            memset(c->coef + ch * CONCEAL_ORDER, 0, CONCEAL_ORDER * sizeof(float));
+
+        // newest sample first
+        for (i = 0; i < CONCEAL_ORDER; i++)
+            c->state[ch * CONCEAL_ORDER + i] = i < n ? x[(n - 1 - i) * c->channels + ch] : 0;
+    }
+}
+
+
+/*
+ * New gap: analyze recent frames, interleaved, oldest first
+ */
+void conceal_start(struct concealer *c, const float *hist, long frames)
+{
+    long fade, k, ch;
+
+    c->done = 0;
+    c->phase = 0;
+    c->length = 0;
+
+    switch (c->policy) {
+        case CONCEAL_REPEAT:
+            if (frames < 2 * (c->rate / PERIOD_MIN_HZ))
+                break;
+
+            c->length = pitch(c, hist, frames);
+            memcpy(c->period, hist + (frames - c->length) * c->channels,
+                   c->length * c->channels * sizeof(float));
+
+            // end of period leads into its start like the frames before it
+            fade = c->length / 4;
+            for (k = 0; k < fade; k++) {
+                float t = (float) (k + 1) / (fade + 1);
+                float *p = c->period + (c->length - fade + k) * c->channels;
+                const float *q = hist + (frames - c->length - fade + k) * c->channels;
+
+                for (ch = 0; ch < c->channels; ch++)
+                    p[ch] = p[ch] * (1 - t) + q[ch] * t;
+            }
+            break;
+
+        case CONCEAL_LPC:
+            lpc(c, hist, frames);
+            break;
+    }
+}
+
+
+/*
+ * Next frames of the gap, level holds and then fades out to silence
+ */
+void conceal(struct concealer *c, float *dst, long frames)
+{
+    long hold = c->rate * CONCEAL_HOLD_MSEC / 1000, fade = c->rate * CONCEAL_FADE_MSEC / 1000;
+    long k, ch, i;
+
+    for (k = 0; k < frames; k++, c->done++, dst += c->channels) {
+        float g = c->done < hold ? 1.0f : 1.0f - (float) (c->done - hold) / fade;
+
+        if (g <= 0 || c->policy == CONCEAL_SILENCE ||
+            (c->policy == CONCEAL_REPEAT && !c->length)) {
+            // silence for the rest, no need to synthesize
+            memset(dst, 0, (frames - k) * c->channels * sizeof(float));
+            c->done += frames - k;
+            return;
+        }
+
+        if (c->policy == CONCEAL_REPEAT) {
+            for (ch = 0; ch < c->channels; ch++)
+                dst[ch] = c->period[c->phase * c->channels + ch] * g;
+
+            if (++c->phase == c->length)
+                c->phase = 0;
+            continue;
+        }
+
+        for (ch = 0; ch < c->channels; ch++) {
+            float *a = c->coef + ch * CONCEAL_ORDER, *s = c->state + ch * CONCEAL_ORDER;
+            float x = 0;
+
+            for (i = 0; i < CONCEAL_ORDER; i++)
+                x -= a[i] * s[i];
+
+            memmove(s + 1, s, (CONCEAL_ORDER - 1) * sizeof(float));
+            s[0] = x;
+            dst[ch] = x * g;
+        }
+    }
+}
@@ -0,0 +1,49 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#ifndef _CONCEAL_H
+#define _CONCEAL_H 1
+
+/*
+ * Packet loss concealment: synthesize frames for gaps no backup could
+ * fill, continuing from the frames played before the gap
+ */
+
+#define CONCEAL_NONE 0           // skip lost frames, timeline shrinks
+#define CONCEAL_SILENCE 1        // silence in place of lost frames
+#define CONCEAL_REPEAT 2         // repeat last waveform period
+#define CONCEAL_LPC 3            // linear prediction extrapolation
+
+#define CONCEAL_HISTORY 2048     // recent frames kept for analysis
+#define CONCEAL_ORDER 16         // linear predictor order
+#define CONCEAL_HOLD_MSEC 10     // full level, then fade out
+#define CONCEAL_FADE_MSEC 30     // silence after hold and fade
+
+struct concealer;
+
+int conceal_policy(const char *name);
+struct concealer *concealer_create(int policy, long channels, long rate);
+void concealer_free(struct concealer *c);
+void conceal_start(struct concealer *c, const float *hist, long frames);
+void conceal(struct concealer *c, float *dst, long frames);
+
+#endif
@@ -0,0 +1,609 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CONVERT_X86 1
+#endif
+
+#include "convert.h"
+#include "logger.h"
+#include "vban.h"
+#include "sample.h"
+
+// full scale of integer formats, float range is [-1.0, 1.0)
+#define U8_SCALE 128.0f
+#define S16_SCALE 32768.0f
+#define S24_SCALE 8388608.0f
+#define S32_SCALE 2147483648.0f
+#define S32_MAX 2147483520.0f    // largest float below 2^31
+
+struct kernels {
+    const char *name;
+    void (*decode[6])(float *, const void *, long);  // to float, by VBAN datatype
+    void (*encode[6])(void *, const float *, long);  // from float
+};
+
+static struct kernels *kernels;
+
+
+/*
+ * Scalar kernels, also handle tails of vector kernels
+ */
+static inline float clampf(float v, float lo, float hi)
+{
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+
+static void u8_decode_scalar(float *d, const void *src, long n)
+{
+    const uint8_t *s = src;
+    long i;
+
+    for (i = 0; i < n; i++)
+        d[i] = ((int32_t) s[i] - 128) * (1.0f / U8_SCALE);
+}
+
+
+static void s16_decode_scalar(float *d, const void *src, long n)
+{
+    const int16_t *s = src;
+    long i;
+
+    for (i = 0; i < n; i++)
+        d[i] = s[i] * (1.0f / S16_SCALE);
+}
+
+
+static void s24_decode_scalar(float *d, const void *src, long n)
+{
+    const uint8_t *s = src;
+    long i;
+
+    for (i = 0; i < n; i++, s += 3) {
+        int32_t v = (int32_t) ((uint32_t) s[0] << 8 | (uint32_t) s[1] << 16 | (uint32_t) s[2] << 24);
+        d[i] = (v >> 8) * (1.0f / S24_SCALE);
+    }
+}
+
+
+static void s32_decode_scalar(float *d, const void *src, long n)
+{
+    const int32_t *s = src;
+    long i;
+
+    for (i = 0; i < n; i++)
+        d[i] = s[i] * (1.0f / S32_SCALE);
+}
+
+
+static void f32_decode(float *d, const void *src, long n)
+{
+    memcpy(d, src, n * sizeof(float));
+}
+
+
+static void f64_decode_scalar(float *d, const void *src, long n)
+{
+    const double *s = src;
+    long i;
+
+    for (i = 0; i < n; i++)
+        d[i] = (float) s[i];
+}
+
+
+static void u8_encode_scalar(void *dst, const float *s, long n)
+{
+    uint8_t *d = dst;
+    long i;
+
+    for (i = 0; i < n; i++)
+        d[i] = (uint8_t) (lrintf(clampf(s[i] * U8_SCALE, -U8_SCALE, U8_SCALE - 1.0f)) + 128);
+}
+
+
+static void s16_encode_scalar(void *dst, const float *s, long n)
+{
+    int16_t *d = dst;
+    long i;
+
+    for (i = 0; i < n; i++)
+        d[i] = (int16_t) lrintf(clampf(s[i] * S16_SCALE, -S16_SCALE, S16_SCALE - 1.0f));
+}
+
+
+static void s24_encode_scalar(void *dst, const float *s, long n)
+{
+    uint8_t *d = dst;
+    long i;
+
+    for (i = 0; i < n; i++, d += 3) {
+        int32_t v = (int32_t) lrintf(clampf(s[i] * S24_SCALE, -S24_SCALE, S24_SCALE - 1.0f));
+        d[0] = v & 0xff;
+        d[1] = (v >> 8) & 0xff;
+        d[2] = (v >> 16) & 0xff;
+    }
+}
+
+
+static void s32_encode_scalar(void *dst, const float *s, long n)
+{
+    int32_t *d = dst;
+    long i;
+
+    for (i = 0; i < n; i++)
+        d[i] = (int32_t) lrintf(clampf(s[i] * S32_SCALE, -S32_SCALE, S32_MAX));
+}
+
+
+static void f32_encode(void *dst, const float *s, long n)
+{
+    memcpy(dst, s, n * sizeof(float));
+}
+
+
+static void f64_encode_scalar(void *dst, const float *s, long n)
+{
+    double *d = dst;
+    long i;
+
+    for (i = 0; i < n; i++)
+        d[i] = s[i];
+}
+
+
+static struct kernels scalar = {
+    "scalar",
+    { u8_decode_scalar, s16_decode_scalar, s24_decode_scalar,
+      s32_decode_scalar, f32_decode, f64_decode_scalar },
+    { u8_encode_scalar, s16_encode_scalar, s24_encode_scalar,
+      s32_encode_scalar, f32_encode, f64_encode_scalar }
+};
+
+
+#ifdef CONVERT_X86
+
+/*
+ * SSE4.1 kernels, four samples per step: byte shuffles unpack and pack
+ * 24-bit samples, saturating packs clamp narrow integers
+ */
+__attribute__((target("sse4.1")))
+static void u8_decode_sse41(float *d, const void *src, long n)
+{
+    const uint8_t *s = src;
+    __m128i bias = _mm_set1_epi32(128);
+    __m128 scale = _mm_set1_ps(1.0f / U8_SCALE);
+    long i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        int32_t w;
+        memcpy(&w, s + i, 4);
+        __m128i v = _mm_sub_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(w)), bias);
+        _mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+    }
+
+    u8_decode_scalar(d + i, s + i, n - i);
+}
+
+
+__attribute__((target("sse4.1")))
+static void s16_decode_sse41(float *d, const void *src, long n)
+{
+    const int16_t *s = src;
+    __m128 scale = _mm_set1_ps(1.0f / S16_SCALE);
+    long i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i v = _mm_cvtepi16_epi32(_mm_loadl_epi64((const void *) (s + i)));
+        _mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+    }
+
+    s16_decode_scalar(d + i, s + i, n - i);
+}
+
+
+__attribute__((target("sse4.1")))
+static void s24_decode_sse41(float *d, const void *src, long n)
+{
+    const uint8_t *s = src;
+    // three bytes of each sample to the top of a 32-bit lane
+    __m128i shuf = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    __m128 scale = _mm_set1_ps(1.0f / S24_SCALE);
+    long i;
+
+    // 16 byte loads, stop while a whole load fits
+    for (i = 0; i + 6 <= n; i += 4) {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const void *) (s + i * 3)), shuf);
+        _mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(v, 8)), scale));
+    }
+
+    s24_decode_scalar(d + i, s + i * 3, n - i);
+}
+
+
+__attribute__((target("sse4.1")))
+static void s32_decode_sse41(float *d, const void *src, long n)
+{
+    const int32_t *s = src;
+    __m128 scale = _mm_set1_ps(1.0f / S32_SCALE);
+    long i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const void *) (s + i));
+        _mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+    }
+
+    s32_decode_scalar(d + i, s + i, n - i);
+}
+
+
+__attribute__((target("sse4.1")))
+static void f64_decode_sse41(float *d, const void *src, long n)
+{
+    const double *s = src;
+    long i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(s + i));
+        __m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(s + i + 2));
+        _mm_storeu_ps(d + i, _mm_movelh_ps(lo, hi));
+    }
+
+    f64_decode_scalar(d + i, s + i, n - i);
+}
+
+
+__attribute__((target("sse4.1")))
+static void u8_encode_sse41(void *dst, const float *s, long n)
+{
+    uint8_t *d = dst;
+    __m128 scale = _mm_set1_ps(U8_SCALE);
+    __m128 lo = _mm_set1_ps(-U8_SCALE);
+    __m128 hi = _mm_set1_ps(U8_SCALE - 1.0f);
+    __m128i bias = _mm_set1_epi16(128);
+    long i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        // clamp first, the bias must not wrap saturated samples
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(s + i), scale), lo), hi);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(s + i + 4), scale), lo), hi);
+        __m128i v = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+
+        v = _mm_add_epi16(v, bias);
+        _mm_storel_epi64((void *) (d + i), _mm_packus_epi16(v, v));
+    }
+
+    u8_encode_scalar(d + i, s + i, n - i);
+}
+
+
+__attribute__((target("sse4.1")))
+static void s16_encode_sse41(void *dst, const float *s, long n)
+{
+    int16_t *d = dst;
+    __m128 scale = _mm_set1_ps(S16_SCALE);
+    __m128 lo = _mm_set1_ps(-S16_SCALE);
+    __m128 hi = _mm_set1_ps(S16_SCALE - 1.0f);
+    long i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        // clamp first, out of range conversions give INT_MIN
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(s + i), scale), lo), hi);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(s + i + 4), scale), lo), hi);
+        _mm_storeu_si128((void *) (d + i), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+    }
+
+    s16_encode_scalar(d + i, s + i, n - i);
+}
+
+
+__attribute__((target("sse4.1")))
+static void s24_encode_sse41(void *dst, const float *s, long n)
+{
+    uint8_t *d = dst;
+    // low three bytes of each 32-bit lane, packed
+    __m128i shuf = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    __m128 scale = _mm_set1_ps(S24_SCALE);
+    __m128 lo = _mm_set1_ps(-S24_SCALE);
+    __m128 hi = _mm_set1_ps(S24_SCALE - 1.0f);
+    long i;
+
+    // 16 byte stores overlap the next step, stop while a whole store fits
+    for (i = 0; i + 6 <= n; i += 4) {
+        __m128 v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(s + i), scale), lo), hi);
+        _mm_storeu_si128((void *) (d + i * 3), _mm_shuffle_epi8(_mm_cvtps_epi32(v), shuf));
+    }
+
+    s24_encode_scalar(d + i * 3, s + i, n - i);
+}
+
+
+__attribute__((target("sse4.1")))
+static void s32_encode_sse41(void *dst, const float *s, long n)
+{
+    int32_t *d = dst;
+    __m128 scale = _mm_set1_ps(S32_SCALE);
+    __m128 lo = _mm_set1_ps(-S32_SCALE);
+    __m128 hi = _mm_set1_ps(S32_MAX);
+    long i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128 v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(s + i), scale), lo), hi);
+        _mm_storeu_si128((void *) (d + i), _mm_cvtps_epi32(v));
+    }
+
+    s32_encode_scalar(d + i, s + i, n - i);
+}
+
+
+__attribute__((target("sse4.1")))
+static void f64_encode_sse41(void *dst, const float *s, long n)
+{
+    double *d = dst;
+    long i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(s + i);
+        _mm_storeu_pd(d + i, _mm_cvtps_pd(v));
+        _mm_storeu_pd(d + i + 2, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+    }
+
+    f64_encode_scalar(d + i, s + i, n - i);
+}
+
+
+static struct kernels sse41 = {
+    "sse4.1",
+    { u8_decode_sse41, s16_decode_sse41, s24_decode_sse41,
+      s32_decode_sse41, f32_decode, f64_decode_sse41 },
+    { u8_encode_sse41, s16_encode_sse41, s24_encode_sse41,
+      s32_encode_sse41, f32_encode, f64_encode_sse41 }
+};
+
+
+/*
+ * AVX2 kernels, eight samples per step, 24-bit ones stay with SSE4.1
+ */
+__attribute__((target("avx2")))
+static void u8_decode_avx2(float *d, const void *src, long n)
+{
+    const uint8_t *s = src;
+    __m256i bias = _mm256_set1_epi32(128);
+    __m256 scale = _mm256_set1_ps(1.0f / U8_SCALE);
+    long i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const void *) (s + i)));
+        v = _mm256_sub_epi32(v, bias);
+        _mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+
+    u8_decode_scalar(d + i, s + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+static void s16_decode_avx2(float *d, const void *src, long n)
+{
+    const int16_t *s = src;
+    __m256 scale = _mm256_set1_ps(1.0f / S16_SCALE);
+    long i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const void *) (s + i)));
+        _mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+
+    s16_decode_scalar(d + i, s + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+static void s32_decode_avx2(float *d, const void *src, long n)
+{
+    const int32_t *s = src;
+    __m256 scale = _mm256_set1_ps(1.0f / S32_SCALE);
+    long i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const void *) (s + i));
+        _mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+
+    s32_decode_scalar(d + i, s + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+static void f64_decode_avx2(float *d, const void *src, long n)
+{
+    const double *s = src;
+    long i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m128 lo = _mm256_cvtpd_ps(_mm256_loadu_pd(s + i));
+        __m128 hi = _mm256_cvtpd_ps(_mm256_loadu_pd(s + i + 4));
+        _mm256_storeu_ps(d + i, _mm256_set_m128(hi, lo));
+    }
+
+    f64_decode_scalar(d + i, s + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+static void u8_encode_avx2(void *dst, const float *s, long n)
+{
+    uint8_t *d = dst;
+    __m256 scale = _mm256_set1_ps(U8_SCALE);
+    __m256 lo = _mm256_set1_ps(-U8_SCALE);
+    __m256 hi = _mm256_set1_ps(U8_SCALE - 1.0f);
+    __m256i bias = _mm256_set1_epi16(128);
+    long i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        // clamp first, the bias must not wrap saturated samples
+        __m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(s + i), scale), lo), hi);
+        __m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(s + i + 8), scale), lo), hi);
+        // packs work within 128-bit lanes, restore sample order
+        __m256i v = _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_cvtps_epi32(a),
+                                                                _mm256_cvtps_epi32(b)), 0xd8);
+        v = _mm256_add_epi16(v, bias);
+        v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0xd8);
+        _mm_storeu_si128((void *) (d + i), _mm256_castsi256_si128(v));
+    }
+
+    u8_encode_scalar(d + i, s + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+static void s16_encode_avx2(void *dst, const float *s, long n)
+{
+    int16_t *d = dst;
+    __m256 scale = _mm256_set1_ps(S16_SCALE);
+    __m256 lo = _mm256_set1_ps(-S16_SCALE);
+    __m256 hi = _mm256_set1_ps(S16_SCALE - 1.0f);
+    long i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        // clamp first, out of range conversions give INT_MIN
+        __m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(s + i), scale), lo), hi);
+        __m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(s + i + 8), scale), lo), hi);
+        __m256i v = _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_cvtps_epi32(a),
+                                                                _mm256_cvtps_epi32(b)), 0xd8);
+        _mm256_storeu_si256((void *) (d + i), v);
+    }
+
+    s16_encode_scalar(d + i, s + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+static void s32_encode_avx2(void *dst, const float *s, long n)
+{
+    int32_t *d = dst;
+    __m256 scale = _mm256_set1_ps(S32_SCALE);
+    __m256 lo = _mm256_set1_ps(-S32_SCALE);
+    __m256 hi = _mm256_set1_ps(S32_MAX);
+    long i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_mul_ps(_mm256_loadu_ps(s + i), scale);
+        v = _mm256_min_ps(_mm256_max_ps(v, lo), hi);
+        _mm256_storeu_si256((void *) (d + i), _mm256_cvtps_epi32(v));
+    }
+
+    s32_encode_scalar(d + i, s + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+static void f64_encode_avx2(void *dst, const float *s, long n)
+{
+    double *d = dst;
+    long i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(s + i);
+        _mm256_storeu_pd(d + i, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+        _mm256_storeu_pd(d + i + 4, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+    }
+
+    f64_encode_scalar(d + i, s + i, n - i);
+}
+
+
+static struct kernels avx2 = {
+    "avx2",
+    { u8_decode_avx2, s16_decode_avx2, s24_decode_sse41,
+      s32_decode_avx2, f32_decode, f64_decode_avx2 },
+    { u8_encode_avx2, s16_encode_avx2, s24_encode_sse41,
+      s32_encode_avx2, f32_encode, f64_encode_avx2 }
+};
+
+#endif
+
+
+/*
+ * Pick kernels for this cpu
+ */
+int convert_init(void)
+{
+    kernels = &scalar;
+
+#ifdef CONVERT_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        kernels = &avx2;
+    else
+    if (__builtin_cpu_supports("sse4.1"))
+        kernels = &sse41;
+#endif
+
+    logger(LOG_VRB, "format conversion: %s", kernels->name);
+
+    return 0;
+}
+
+
+/*
+ * Convert samples between supported formats, blocks of float32 in
+ * between; buffers must not overlap
+ */
+void convert(void *dst, long dst_format, const void *src, long src_format, long samples)
+{
+    long dsize = sample_size(dst_format), ssize = sample_size(src_format), n;
+    float block[CONVERT_BLOCK];
+
+    if (!dsize || !ssize)
+        return;
+
+    if (dst_format == src_format) {
+        memcpy(dst, src, samples * ssize);
+        return;
+    }
+
+    for (; samples > 0; samples -= n) {
+        n = samples < CONVERT_BLOCK ? samples : CONVERT_BLOCK;
+
+        // float32 on either side needs one pass
+        if (src_format == VBAN_DATATYPE_FLOAT32)
+            kernels->encode[dst_format](dst, src, n);
+        else
+        if (dst_format == VBAN_DATATYPE_FLOAT32)
+            kernels->decode[src_format](dst, src, n);
+        else {
+            kernels->decode[src_format](block, src, n);
+            kernels->encode[dst_format](dst, block, n);
+        }
+
+        src = (const char *) src + n * ssize;
+        dst = (char *) dst + n * dsize;
+    }
+}
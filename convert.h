@@ -0,0 +1,35 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#ifndef _CONVERT_H
+#define _CONVERT_H 1
+
+/*
+ * Sample format conversion, through float32 in blocks
+ */
+
+#define CONVERT_BLOCK 1024       // samples converted per pass
+
+int convert_init(void);
+void convert(void *dst, long dst_format, const void *src, long src_format, long samples);
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <math.h>
+#include "drift.h"
+#include "logger.h"
+
+
+/*
+ * Least squares slope of block minima, lag nanoseconds per nanosecond
+ */
+static double slope(struct stream *stream)
+{
+    long n = stream->drift_blocks < STREAM_DRIFT_BLOCKS ?
+             stream->drift_blocks : STREAM_DRIFT_BLOCKS, i;
+    double tm = 0, lm = 0, cov = 0, var = 0;
+
+    for (i = 0; i < n; i++) {
+        tm += stream->drift_t[i];
+        lm += stream->drift_lag[i];
+    }
+
+    tm /= n;
+    lm /= n;
+
+    for (i = 0; i < n; i++) {
+        cov += (stream->drift_t[i] - tm) * (stream->drift_lag[i] - lm);
+        var += (stream->drift_t[i] - tm) * (stream->drift_t[i] - tm);
+    }
+
+    return var > 0 ? cov / var : 0;
+}
+
+
+void drift_start(struct stream *stream, struct timespec *ts, uint32_t seq)
+{
+    stream->drift_origin = *ts;
+    stream->drift_seq = seq;
+    stream->drift_block = 0;
+    stream->drift_min = INFINITY;
+    stream->drift_at = 0;
+    stream->drift_blocks = 0;
+}
+
+
+/*
+ * Account packet received in order, estimate is updated once per block
+ */
+void drift_packet(struct stream *stream, struct timespec *ts, uint32_t seq)
+{
+    double t = (ts->tv_sec - stream->drift_origin.tv_sec) * 1000000000.0 +
+               (ts->tv_nsec - stream->drift_origin.tv_nsec);
+    double lag = t - (double) (uint32_t) (seq - stream->drift_seq) * stream->frames *
+                     1000000000.0 / stream->sample_rate;
+    int64_t block = (int64_t) (t / (DRIFT_BLOCK_MSEC * 1000000.0));
+
+    if (block != stream->drift_block && stream->drift_min < INFINITY) {
+        long last = (stream->drift_blocks + STREAM_DRIFT_BLOCKS - 1) % STREAM_DRIFT_BLOCKS;
+        long i = stream->drift_blocks % STREAM_DRIFT_BLOCKS;
+
+        if (stream->drift_blocks &&
+            fabs(stream->drift_min - stream->drift_lag[last]) > DRIFT_STEP_MSEC * 1000000.0) {
+            // local clock stepped or sender restarted its clock
+            logger(LOG_DBG, "[%s@%s] arrival time step, drift estimation restarted",
+                   stream->name, stream->ifname);
+            drift_start(stream, ts, seq);
+            return;
+        }
+
+        stream->drift_t[i] = stream->drift_at;
+        stream->drift_lag[i] = stream->drift_min;
+        stream->drift_blocks++;
+        stream->drift_min = INFINITY;
+
+        // lag grows when sender clock is slow
+        if (stream->drift_blocks >= DRIFT_BLOCKS_MIN)
+            stream->drift_ppm = -slope(stream) * 1000000.0;
+    }
+
+    stream->drift_block = block;
+
+    if (lag < stream->drift_min) {
+        stream->drift_min = lag;
+        stream->drift_at = t;
+    }
+}
@@ -0,0 +1,42 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#ifndef _DRIFT_H
+#define _DRIFT_H 1
+
+#include <time.h>
+#include <stdint.h>
+#include "streams.h"
+
+/*
+ * Sender clock drift against local clock, estimated from packet arrival
+ * times: the lowest network delay of each block follows the clock rate
+ */
+
+#define DRIFT_BLOCK_MSEC 1000      // arrival lag minimum taken per block
+#define DRIFT_BLOCKS_MIN 4         // blocks before first estimate
+#define DRIFT_STEP_MSEC 20         // larger lag change is a clock step, restart
+
+void drift_start(struct stream *stream, struct timespec *ts, uint32_t seq);
+void drift_packet(struct stream *stream, struct timespec *ts, uint32_t seq);
+
+#endif
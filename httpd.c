@@ -20,12 +20,15 @@
  *  USA.
  */
 
+#define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <string.h>
 #include <strings.h>
+#include <stdarg.h>
 #include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -36,7 +39,9 @@
 #include "httpd.h"
 #include "logger.h"
 #include "streams.h"
+#include "input.h"
 #include "output.h"
+#include "pool.h"
 
 
 static struct snapshot_cell *snap = NULL;
@@ -58,6 +63,22 @@ static char ok200[] = "HTTP/1.0 200 OK\r\n"
                       "Connection: close\r\n"
                       "\r\n";
 
+static char metrics200[] = "HTTP/1.0 200 OK\r\n"
+                           "Server: vban2pipe\r\n"
+                           "Content-Type: text/plain; version=0.0.4\r\n"
+                           "Content-Length: %d\r\n"
+                           "Connection: close\r\n"
+                           "\r\n";
+
+
+// growing text buffer
+struct text {
+    char *buffer;
+    size_t size;
+    size_t len;
+    int failed;
+};
+
 
 static char *json_escape(char *src)
 {
@@ -100,6 +121,30 @@ static char *json_escape(char *src)
 }
 
 
+static void peer_name(struct sockaddr_storage *addr, char *peer, size_t size)
+{
+    switch (((struct sockaddr *) addr)->sa_family) {
+        case AF_INET: {
+            struct sockaddr_in *in = (void *) addr;
+            inet_ntop(AF_INET, &in->sin_addr, peer, size);
+            sprintf(peer + strlen(peer), ":%d", ntohs(in->sin_port));
+            break;
+        };
+#ifdef AF_INET6
+        case AF_INET6: {
+            struct sockaddr_in6 *in6 = (void *) addr;
+            peer[0] = '[';
+            inet_ntop(AF_INET6, &in6->sin6_addr, peer + 1, size - 1);
+            sprintf(peer + strlen(peer), "]:%d", ntohs(in6->sin6_port));
+            break;
+        };
+#endif
+        default:
+            strcpy(peer, "<unsupported address family>");
+    }
+}
+
+
 static char *json_dump(void)
 {
     static size_t buffer_size = 0;
@@ -120,16 +165,78 @@ static char *json_dump(void)
     cell = snap;
 
     if (cell == NULL) {
-        sprintf(buffer, "{\"lost\":0, \"streams\":[]}\n");
+        sprintf(buffer, "{\"lost\":0, \"batch_average\":0.00, \"gro_coalesced\":0, \"ring_drops\":0, \"kernel_drops\":0, \"rcvbuf\":0"
+                ", \"wakeup_us\":0.00, \"wakeup_max_us\":0.00, \"pool_allocs\":0"
+                ", \"pool_blocks\":0, \"pool_free\":0, \"depth\":0, \"depth_max\":0"
+                ", \"late\":0, \"late_lost\":0, \"overrun\":0, \"short_writes\":0"
+                ", \"crossfades\":0, \"concealed\":0"
+                ", \"sessions\":[], \"streams\":[]}\n");
         return buffer;
     }
 
+    len = sprintf(buffer, "{\"lost\":%ld", cell->lost);
+    len += sprintf(buffer + len, ", \"batch_average\":%.02f", cell->input.batches ?
+                   (double) cell->input.packets / (double) cell->input.batches : 0.0);
+    len += sprintf(buffer + len, ", \"gro_coalesced\":%ld", cell->input.coalesced);
+    len += sprintf(buffer + len, ", \"ring_drops\":%ld", cell->input.drops);
+    len += sprintf(buffer + len, ", \"kernel_drops\":%ld", cell->input.kdrops);
+    len += sprintf(buffer + len, ", \"rcvbuf\":%ld", cell->input.rcvbuf);
+    len += sprintf(buffer + len, ", \"wakeup_us\":%.02f", cell->input.latency / 1000.0);
+    len += sprintf(buffer + len, ", \"wakeup_max_us\":%.02f", cell->input.latency_max / 1000.0);
+    len += sprintf(buffer + len, ", \"pool_allocs\":%ld", cell->pool.allocs);
+    len += sprintf(buffer + len, ", \"pool_blocks\":%ld", cell->pool.blocks);
+    len += sprintf(buffer + len, ", \"pool_free\":%ld", cell->pool.free);
+    len += sprintf(buffer + len, ", \"depth\":%ld", cell->output.depth);
+    len += sprintf(buffer + len, ", \"depth_max\":%ld", cell->output.capacity);
+    len += sprintf(buffer + len, ", \"late\":%ld", cell->output.late);
+    len += sprintf(buffer + len, ", \"late_lost\":%ld", cell->output.late_lost);
+    len += sprintf(buffer + len, ", \"overrun\":%ld", cell->output.overrun);
+    len += sprintf(buffer + len, ", \"short_writes\":%ld", cell->output.short_writes);
+    len += sprintf(buffer + len, ", \"crossfades\":%ld", cell->output.crossfades);
+    len += sprintf(buffer + len, ", \"concealed\":%ld", cell->output.concealed);
+    len += sprintf(buffer + len, ", \"sessions\":[");
+
+    for (i = 0; i < cell->sessions; i++) {
+        struct session_snap *se = &cell->sess[i];
+
+        // allocate more buffer size if needed
+        if (buffer_size - len < 1024 + 6 * (strlen(se->pattern) + strlen(se->pipename))) {
+            char *newbuffer = realloc(buffer, buffer_size + 4096 +
+                                      6 * (strlen(se->pattern) + strlen(se->pipename)));
+
+            if (!newbuffer)
+                return NULL;
+
+            buffer_size += 4096 + 6 * (strlen(se->pattern) + strlen(se->pipename));
+            buffer = newbuffer;
+        }
+
+        len += sprintf(buffer + len, "%s\n {\"route\":\"%s\"", i ? "," : "", json_escape(se->pattern));
+        len += sprintf(buffer + len, ", \"pipe\":\"%s\"", json_escape(se->pipename));
+        len += sprintf(buffer + len, ", \"streams\":%d", se->streams);
+        len += sprintf(buffer + len, ", \"lost\":%ld", se->lost);
+        len += sprintf(buffer + len, ", \"depth\":%ld", se->output.depth);
+        len += sprintf(buffer + len, ", \"depth_max\":%ld", se->output.capacity);
+        len += sprintf(buffer + len, ", \"late\":%ld", se->output.late);
+        len += sprintf(buffer + len, ", \"late_lost\":%ld", se->output.late_lost);
+        len += sprintf(buffer + len, ", \"overrun\":%ld", se->output.overrun);
+        len += sprintf(buffer + len, ", \"short_writes\":%ld", se->output.short_writes);
+        len += sprintf(buffer + len, ", \"crossfades\":%ld", se->output.crossfades);
+        len += sprintf(buffer + len, ", \"concealed\":%ld", se->output.concealed);
+        len += sprintf(buffer + len, ", \"silence_closes\":%ld", se->output.closes);
+        len += sprintf(buffer + len, ", \"drift_ppm\":%.02f", se->output.drift_ppm);
+        len += sprintf(buffer + len, ", \"ratio\":%.06f", se->output.ratio);
+        len += sprintf(buffer + len, ", \"fill\":%ld}", se->output.fill);
+    }
+
+    len += sprintf(buffer + len, "%s]", cell->sessions ? "\n" : "");
+
     if (cell->count == 0) {
-        sprintf(buffer, "{\"lost\":%ld, \"streams\":[]}\n", cell->lost);
+        strcpy(buffer + len, ", \"streams\":[]}\n");
         return buffer;
     }
 
-    len = sprintf(buffer, "{\"lost\":%ld, \"streams\":[\n", cell->lost);
+    len += sprintf(buffer + len, ", \"streams\":[\n");
 
     for (i = 0; i < cell->count; i++) {
         struct stream_snap *ss = &cell->ss[i];
@@ -146,40 +253,34 @@ static char *json_dump(void)
         }
 
         // parse peer address
-        switch (((struct sockaddr *) &ss->peer)->sa_family) {
-            case AF_INET: {
-                struct sockaddr_in *in = (void *) &ss->peer;
-                inet_ntop(AF_INET, &in->sin_addr, peer, sizeof(peer));
-                sprintf(peer + strlen(peer), ":%d", ntohs(in->sin_port));
-                break;
-            };
-#ifdef AF_INET6
-            case AF_INET6: {
-                struct sockaddr_in6 *in6 = (void *) &ss->peer;
-                peer[0] = '[';
-                inet_ntop(AF_INET6, &in6->sin6_addr, peer + 1, sizeof(peer) - 1);
-                sprintf(peer + strlen(peer), "]:%d", ntohs(in6->sin6_port));
-                break;
-            };
-#endif
-            default:
-                strcpy(peer, "<unsupported address family>");
-        }
+        peer_name(&ss->peer, peer, sizeof(peer));
 
         len += sprintf(buffer + len, " {\"name\":\"%s\"", json_escape(ss->name));
-        len += sprintf(buffer + len, ", \"role\":\"%s\"", i ? "backup" : "primary");
+        len += sprintf(buffer + len, ", \"session\":\"%s\"", json_escape(ss->session));
+        len += sprintf(buffer + len, ", \"role\":\"%s\"", ss->primary ? "primary" : "backup");
         len += sprintf(buffer + len, ", \"ifname\":\"%s\"", json_escape(ss->ifname));
         len += sprintf(buffer + len, ", \"peer\":\"%s\"", json_escape(peer));
         len += sprintf(buffer + len, ", \"format\":\"%s\"", json_escape(ss->format_name));
         len += sprintf(buffer + len, ", \"rate\":%ld", ss->sample_rate);
         len += sprintf(buffer + len, ", \"channels\":%ld", ss->channels);
         len += sprintf(buffer + len, ", \"expected\":%lu", (long unsigned)ss->expected);
+        len += sprintf(buffer + len, ", \"packets\":%ld", ss->packets);
         len += sprintf(buffer + len, ", \"lost\":%ld", ss->lost);
+        len += sprintf(buffer + len, ", \"reordered\":%ld", ss->reordered);
+        len += sprintf(buffer + len, ", \"dropped\":%ld", ss->dropped);
         len += sprintf(buffer + len, ", \"ignored\":%s", ss->ignore ? "true" : "false");
         len += sprintf(buffer + len, ", \"synchonized\":%s", ss->insync < 3 ? "false" : "true");
         len += sprintf(buffer + len, ", \"offset\":%lld", (long long)ss->offset);
+        len += sprintf(buffer + len, ", \"sync_attempts\":%ld", ss->sync_attempts);
+        len += sprintf(buffer + len, ", \"sync_ms\":%.01f", ss->sync_msec);
+        len += sprintf(buffer + len, ", \"correlated\":%s", ss->correlated ? "true" : "false");
+        len += sprintf(buffer + len, ", \"confidence\":%.03f", ss->confidence);
+        len += sprintf(buffer + len, ", \"drift_ppm\":%.02f", ss->drift_ppm);
         len += sprintf(buffer + len, ", \"average_us\":%.02f", ss->dt_average / 1000.0);
         len += sprintf(buffer + len, ", \"stddev_us\":%.02f", sqrt(ss->dt_variance) / 1000.0);
+        len += sprintf(buffer + len, ", \"loss\":%.04f", ss->loss);
+        len += sprintf(buffer + len, ", \"health\":%.03f", ss->health);
+        len += sprintf(buffer + len, ", \"timeout_ms\":%ld", ss->timeout);
         len += sprintf(buffer + len, ", \"uptime\":%ld",
                        (long) (ss->ts_last.tv_sec - ss->ts_first.tv_sec));
 
@@ -193,6 +294,250 @@ static char *json_dump(void)
 }
 
 
+/*
+ * Append formatted text, grow buffer if needed
+ */
+static void text_printf(struct text *t, const char *fmt, ...)
+{
+    char *newbuffer;
+    va_list ap;
+    int rc;
+
+    if (t->failed)
+        return;
+
+    while (1) {
+        va_start(ap, fmt);
+        rc = vsnprintf(t->buffer + t->len, t->size - t->len, fmt, ap);
+        va_end(ap);
+
+        if (rc < 0) {
+            t->failed = 1;
+            return;
+        }
+
+        if (t->len + rc < t->size)
+            break;
+
+        newbuffer = realloc(t->buffer, t->size + rc + 4096);
+        if (!newbuffer) {
+            t->failed = 1;
+            return;
+        }
+
+        t->size += rc + 4096;
+        t->buffer = newbuffer;
+    }
+
+    t->len += rc;
+}
+
+
+/*
+ * Escape prometheus label value
+ */
+static void prom_escape(char *dst, const char *src, size_t size)
+{
+    char *end = dst + size - 2;
+
+    for (; *src && dst < end; src++)
+        switch (*src) {
+            case '"': *dst++ = '\\'; *dst++ = '"'; break;
+            case '\\': *dst++ = '\\'; *dst++ = '\\'; break;
+            case '\n': *dst++ = '\\'; *dst++ = 'n'; break;
+            default: *dst++ = *src;
+        }
+
+    *dst = '\0';
+}
+
+
+static void metric_family(struct text *t, const char *name, const char *type, const char *help)
+{
+    text_printf(t, "# HELP vban2pipe_%s %s\n# TYPE vban2pipe_%s %s\n", name, help, name, type);
+}
+
+
+/*
+ * Render prometheus text exposition from the current snapshot
+ */
+static char *metrics_dump(void)
+{
+    static struct text t = { NULL, 0, 0, 0 };
+    struct snapshot_cell *cell;
+    char (*labels)[1024] = NULL;
+    char a[128], b[128], c[128], d[128];
+    int i;
+
+    t.len = 0;
+    t.failed = 0;
+
+    if (!t.buffer) {
+        t.buffer = malloc(16384);
+        if (!t.buffer)
+            return NULL;
+
+        t.size = 16384;
+    }
+
+    t.buffer[0] = '\0';
+
+    // atomic operation. no need to lock
+    cell = snap;
+
+    if (cell == NULL)
+        return t.buffer;
+
+    // receive loop
+    metric_family(&t, "receive_packets_total", "counter", "Packets received by the receive loop.");
+    text_printf(&t, "vban2pipe_receive_packets_total %ld\n", cell->input.packets);
+    metric_family(&t, "receive_batches_total", "counter", "Receive loop batches.");
+    text_printf(&t, "vban2pipe_receive_batches_total %ld\n", cell->input.batches);
+    metric_family(&t, "receive_coalesced_total", "counter", "Packets received as part of GRO coalesced datagrams.");
+    text_printf(&t, "vban2pipe_receive_coalesced_total %ld\n", cell->input.coalesced);
+    metric_family(&t, "receive_ring_drops_total", "counter", "Packets dropped by the receive ring.");
+    text_printf(&t, "vban2pipe_receive_ring_drops_total %ld\n", cell->input.drops);
+    metric_family(&t, "receive_kernel_drops_total", "counter", "Packets dropped by the kernel on the receive sockets.");
+    text_printf(&t, "vban2pipe_receive_kernel_drops_total %ld\n", cell->input.kdrops);
+    metric_family(&t, "receive_buffer_bytes", "gauge", "Socket receive buffer size.");
+    text_printf(&t, "vban2pipe_receive_buffer_bytes %ld\n", cell->input.rcvbuf);
+    metric_family(&t, "receive_wakeup_seconds", "gauge", "Average delay from packet arrival to processing.");
+    text_printf(&t, "vban2pipe_receive_wakeup_seconds %.9f\n", cell->input.latency / 1e9);
+    metric_family(&t, "receive_wakeup_max_seconds", "gauge", "Maximum delay from packet arrival to processing.");
+    text_printf(&t, "vban2pipe_receive_wakeup_max_seconds %.9f\n", cell->input.latency_max / 1e9);
+    metric_family(&t, "pool_allocations_total", "counter", "Packet pool allocations.");
+    text_printf(&t, "vban2pipe_pool_allocations_total %ld\n", cell->pool.allocs);
+    metric_family(&t, "pool_blocks", "gauge", "Packet pool blocks.");
+    text_printf(&t, "vban2pipe_pool_blocks %ld\n", cell->pool.blocks);
+    metric_family(&t, "pool_free_blocks", "gauge", "Free packet pool blocks.");
+    text_printf(&t, "vban2pipe_pool_free_blocks %ld\n", cell->pool.free);
+
+    // sessions
+    if (cell->sessions) {
+        labels = malloc(cell->sessions * sizeof(*labels));
+        if (!labels)
+            return NULL;
+
+        for (i = 0; i < cell->sessions; i++) {
+            prom_escape(a, cell->sess[i].pattern, sizeof(a));
+            prom_escape(b, cell->sess[i].pipename, sizeof(b));
+            snprintf(labels[i], sizeof(*labels), "session=\"%s\",pipe=\"%s\"", a, b);
+        }
+
+#define SESSION_METRIC(name, type, help, fmt, value) \
+        metric_family(&t, name, type, help); \
+        for (i = 0; i < cell->sessions; i++) { \
+            struct session_snap *se = &cell->sess[i]; \
+            text_printf(&t, "vban2pipe_" name "{%s} " fmt "\n", labels[i], value); \
+        }
+
+        SESSION_METRIC("session_streams", "gauge", "Streams routed to the session.",
+                       "%d", se->streams);
+        SESSION_METRIC("output_lost_frames_total", "counter", "Frames lost on output.",
+                       "%ld", se->lost);
+        SESSION_METRIC("output_concealed_frames_total", "counter", "Lost frames synthesized by concealment.",
+                       "%ld", se->output.concealed);
+        SESSION_METRIC("output_late_packets_total", "counter", "Packets arrived after their frames were flushed.",
+                       "%ld", se->output.late);
+        SESSION_METRIC("output_late_lost_frames_total", "counter", "Frames of late packets that were lost.",
+                       "%ld", se->output.late_lost);
+        SESSION_METRIC("output_overrun_total", "counter", "Output ring overruns.",
+                       "%ld", se->output.overrun);
+        SESSION_METRIC("output_short_writes_total", "counter", "Partial pipe writes.",
+                       "%ld", se->output.short_writes);
+        SESSION_METRIC("output_crossfades_total", "counter", "Crossfades between primary and backup data.",
+                       "%ld", se->output.crossfades);
+        SESSION_METRIC("output_silence_closes_total", "counter", "Output pipe closed on silence.",
+                       "%ld", se->output.closes);
+        SESSION_METRIC("output_depth_frames", "gauge", "Output ring depth.",
+                       "%ld", se->output.depth);
+        SESSION_METRIC("output_capacity_frames", "gauge", "Output ring capacity.",
+                       "%ld", se->output.capacity);
+        SESSION_METRIC("output_drift_ppm", "gauge", "Primary sender clock error compensated on output.",
+                       "%.2f", se->output.drift_ppm);
+        SESSION_METRIC("output_resample_ratio", "gauge", "Output resampling ratio.",
+                       "%.6f", se->output.ratio);
+        SESSION_METRIC("output_fill_frames", "gauge", "Frames queued in the writer and pipe, -1 if unknown.",
+                       "%ld", se->output.fill);
+
+#undef SESSION_METRIC
+
+        free(labels);
+        labels = NULL;
+    }
+
+    // streams
+    if (cell->count) {
+        labels = malloc(cell->count * sizeof(*labels));
+        if (!labels)
+            return NULL;
+
+        for (i = 0; i < cell->count; i++) {
+            struct stream_snap *ss = &cell->ss[i];
+            char peer[128];
+
+            peer_name(&ss->peer, peer, sizeof(peer));
+            prom_escape(a, ss->session, sizeof(a));
+            prom_escape(b, ss->name, sizeof(b));
+            prom_escape(c, ss->ifname, sizeof(c));
+            prom_escape(d, peer, sizeof(d));
+            snprintf(labels[i], sizeof(*labels), "session=\"%s\",stream=\"%s\",interface=\"%s\",peer=\"%s\"",
+                     a, b, c, d);
+        }
+
+#define STREAM_METRIC(name, type, help, fmt, value) \
+        metric_family(&t, name, type, help); \
+        for (i = 0; i < cell->count; i++) { \
+            struct stream_snap *ss = &cell->ss[i]; \
+            text_printf(&t, "vban2pipe_" name "{%s} " fmt "\n", labels[i], value); \
+        }
+
+        STREAM_METRIC("stream_primary", "gauge", "1 if primary stream of the session, 0 if backup.",
+                      "%d", ss->primary ? 1 : 0);
+        STREAM_METRIC("stream_packets_total", "counter", "Packets received.",
+                      "%ld", ss->packets);
+        STREAM_METRIC("stream_lost_packets", "gauge", "Packets lost, decreases when a late packet is restored.",
+                      "%ld", ss->lost);
+        STREAM_METRIC("stream_restored_packets_total", "counter", "Late packets restored within the reorder window.",
+                      "%ld", ss->reordered);
+        STREAM_METRIC("stream_dropped_packets_total", "counter", "Duplicates and packets too late for the reorder window.",
+                      "%ld", ss->dropped);
+        STREAM_METRIC("stream_sync_attempts_total", "counter", "Offset searches made.",
+                      "%ld", ss->sync_attempts);
+        STREAM_METRIC("stream_offset_frames", "gauge", "Offset against the primary stream.",
+                      "%lld", (long long) ss->offset);
+        STREAM_METRIC("stream_synchronized", "gauge", "1 if synchronized with the primary stream.",
+                      "%d", ss->insync < 3 ? 0 : 1);
+        STREAM_METRIC("stream_ignored", "gauge", "1 if the stream is ignored.",
+                      "%d", ss->ignore ? 1 : 0);
+        STREAM_METRIC("stream_correlated", "gauge", "1 if synchronized by cross-correlation.",
+                      "%d", ss->correlated ? 1 : 0);
+        STREAM_METRIC("stream_confidence", "gauge", "Normalized correlation at offset.",
+                      "%.3f", ss->confidence);
+        STREAM_METRIC("stream_interval_seconds", "gauge", "Average time between packets.",
+                      "%.9f", ss->dt_average / 1e9);
+        STREAM_METRIC("stream_interval_stddev_seconds", "gauge", "Standard deviation of time between packets.",
+                      "%.9f", sqrt(ss->dt_variance) / 1e9);
+        STREAM_METRIC("stream_loss_ratio", "gauge", "Lost packets ratio.",
+                      "%.4f", ss->loss);
+        STREAM_METRIC("stream_health", "gauge", "Stream health, 1 for perfect stream, lower is worse.",
+                      "%.3f", ss->health);
+        STREAM_METRIC("stream_drift_ppm", "gauge", "Sender clock error against local clock.",
+                      "%.2f", ss->drift_ppm);
+        STREAM_METRIC("stream_timeout_seconds", "gauge", "Offline timeout.",
+                      "%.3f", ss->timeout / 1000.0);
+        STREAM_METRIC("stream_uptime_seconds", "gauge", "Time since first packet.",
+                      "%ld", (long) (ss->ts_last.tv_sec - ss->ts_first.tv_sec));
+
+#undef STREAM_METRIC
+
+        free(labels);
+    }
+
+    return t.failed ? NULL : t.buffer;
+}
+
+
 static void *httpd_accept(void *userdata)
 {
     int sock, lsock = *((int *) userdata);
@@ -201,7 +546,7 @@ static void *httpd_accept(void *userdata)
     struct timespec ts;
     char buffer[8192];
     socklen_t len;
-    char *json;
+    char *reply, *header;
     int size;
 
     while (1) {
@@ -298,12 +643,24 @@ static void *httpd_accept(void *userdata)
             continue;
         }
 
-        // dump statistic
-        json = json_dump();
+        // dump statistic, prometheus metrics or json
+        if (!strncmp("/metrics", buffer + 4, 8) &&
+            (buffer[12] == ' ' || buffer[12] == '?' || buffer[12] == '\r' || buffer[12] == '\n')) {
+            reply = metrics_dump();
+            header = metrics200;
+        } else {
+            reply = json_dump();
+            header = ok200;
+        }
+
+        if (reply == NULL) {
+            close(sock);
+            continue;
+        }
 
-        size = sprintf(buffer, ok200, strlen(json));
+        size = sprintf(buffer, header, strlen(reply));
         write(sock, buffer, size);
-        write(sock, json, strlen(json));
+        write(sock, reply, strlen(reply));
         close(sock);
     }
 
@@ -311,17 +668,33 @@ static void *httpd_accept(void *userdata)
 }
 
 
-void httpd_update(struct stream *streams)
+/*
+ * Sum output counters, depth is the deepest one
+ */
+static void output_total(struct output_stats *total, struct output_stats *stats)
+{
+    if (total->depth < stats->depth)
+        total->depth = stats->depth;
+
+    if (total->capacity < stats->capacity)
+        total->capacity = stats->capacity;
+
+    total->late += stats->late;
+    total->late_lost += stats->late_lost;
+    total->overrun += stats->overrun;
+    total->short_writes += stats->short_writes;
+    total->crossfades += stats->crossfades;
+    total->concealed += stats->concealed;
+    total->closes += stats->closes;
+}
+
+
+void httpd_update(struct session *sessions)
 {
     struct snapshot_cell *cell;
+    struct session *session;
     struct stream *stream;
-    int i, count;
-
-    // no streams connected
-    if (!streams) {
-        snap = NULL;
-        return;
-    }
+    int i, j, count, scount;
 
     // select cell to save
     if (snap == &cell1)
@@ -332,9 +705,10 @@ void httpd_update(struct stream *streams)
     else
         cell = &cell1;
 
-    // count streams
-    for (count = 0, stream = streams; stream; stream = stream->next)
-        count++;
+    // count sessions and streams
+    for (scount = 0, count = 0, session = sessions; session; scount++, session = session->next)
+        for (stream = session->streams; stream; stream = stream->next)
+            count++;
 
     // check available memory in cell
     if (count > cell->ss_size) {
@@ -348,30 +722,75 @@ void httpd_update(struct stream *streams)
         cell->ss = ss;
     }
 
-    // save lost frames
-    cell->lost = output_lost();
-
-    // save streams stat
-    for (i = 0, stream = streams; stream; i++, stream = stream->next) {
-        strcpy(cell->ss[i].ifname, stream->ifname);
-        strcpy(cell->ss[i].name, stream->name);
-
-        cell->ss[i].peer        = stream->peer;
-        cell->ss[i].format_name = stream->format_name;
-        cell->ss[i].sample_rate = stream->sample_rate;
-        cell->ss[i].channels    = stream->channels;
-        cell->ss[i].lost        = stream->lost;
-        cell->ss[i].expected    = stream->expected;
-        cell->ss[i].ts_first    = stream->ts_first;
-        cell->ss[i].ts_last     = stream->ts_last;
-        cell->ss[i].dt_average  = stream->dt_average;
-        cell->ss[i].dt_variance = stream->dt_variance;
-        cell->ss[i].ignore      = stream->ignore;
-        cell->ss[i].insync      = stream->insync;
-        cell->ss[i].offset      = stream->offset;
+    if (scount > cell->sess_size) {
+        void *sess;
+
+        sess = realloc(cell->sess, scount * sizeof(struct session_snap));
+        if (sess == NULL)
+            return;
+
+        cell->sess_size = scount;
+        cell->sess = sess;
+    }
+
+    // save receive counters
+    input_stats(&cell->input);
+    pool_stats(&cell->pool);
+
+    cell->lost = 0;
+    memset(&cell->output, 0, sizeof(cell->output));
+
+    for (i = 0, j = 0, session = sessions; session; j++, session = session->next) {
+        struct session_snap *se = &cell->sess[j];
+        int first = i;
+
+        // save lost frames and output counters
+        se->pattern = session->pattern;
+        se->pipename = session->pipenames[0];
+        se->lost = output_lost(session->output);
+        output_stats(session->output, &se->output);
+
+        cell->lost += se->lost;
+        output_total(&cell->output, &se->output);
+
+        // save streams stat
+        for (stream = session->streams; stream; i++, stream = stream->next) {
+            strcpy(cell->ss[i].ifname, stream->ifname);
+            strcpy(cell->ss[i].name, stream->name);
+
+            cell->ss[i].session     = session->pattern;
+            cell->ss[i].primary     = stream == session->streams;
+            cell->ss[i].peer        = stream->peer;
+            cell->ss[i].format_name = stream->format_name;
+            cell->ss[i].sample_rate = stream->sample_rate;
+            cell->ss[i].channels    = stream->channels;
+            cell->ss[i].packets     = stream->packets;
+            cell->ss[i].lost        = stream->lost;
+            cell->ss[i].reordered   = stream->reordered;
+            cell->ss[i].dropped     = stream->dropped;
+            cell->ss[i].expected    = stream->expected;
+            cell->ss[i].ts_first    = stream->ts_first;
+            cell->ss[i].ts_last     = stream->ts_last;
+            cell->ss[i].dt_average  = stream->dt_average;
+            cell->ss[i].dt_variance = stream->dt_variance;
+            cell->ss[i].loss        = stream->loss;
+            cell->ss[i].health      = stream->health;
+            cell->ss[i].timeout     = stream->timeout;
+            cell->ss[i].ignore      = stream->ignore;
+            cell->ss[i].insync      = stream->insync;
+            cell->ss[i].offset      = stream->offset;
+            cell->ss[i].sync_attempts = stream->sync_attempts;
+            cell->ss[i].sync_msec   = stream->sync_msec;
+            cell->ss[i].correlated  = stream->correlated;
+            cell->ss[i].confidence  = stream->confidence;
+            cell->ss[i].drift_ppm   = stream->drift_ppm;
+        }
+
+        se->streams = i - first;
     }
 
     cell->count = i;
+    cell->sessions = j;
 
     // update snapshot pointer
     // this is atomic operation, no need to lock
@@ -379,11 +798,13 @@ void httpd_update(struct stream *streams)
 }
 
 
-int httpd(int sock)
+int httpd(int sock, int cpu)
 {
+    struct sched_param param;
     pthread_attr_t attr;
     pthread_t thread;
     static int arg;
+    cpu_set_t cpus;
     int rc;
 
     if ((rc = pthread_attr_init(&attr))) {
@@ -396,6 +817,25 @@ int httpd(int sock)
         return -1;
     }
 
+    // never inherit realtime priority
+    param.sched_priority = 0;
+    if ((rc = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED)) ||
+        (rc = pthread_attr_setschedpolicy(&attr, SCHED_OTHER)) ||
+        (rc = pthread_attr_setschedparam(&attr, &param))) {
+        logger(LOG_ERR, "pthread_attr_setsched failed: %s", strerror(rc));
+        return -1;
+    }
+
+    // keep off the receive thread core
+    if (cpu >= 0 && sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+        CPU_CLR(cpu, &cpus);
+        if (CPU_COUNT(&cpus) > 0 &&
+            (rc = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus))) {
+            logger(LOG_ERR, "pthread_attr_setaffinity_np failed: %s", strerror(rc));
+            return -1;
+        }
+    }
+
     arg = sock;
     if ((rc = pthread_create(&thread, &attr, httpd_accept, &arg))) {
         logger(LOG_ERR, "pthread_create failed: %s", strerror(-rc));
@@ -26,6 +26,10 @@
 #include <stdint.h>
 #include <net/if.h>
 #include "streams.h"
+#include "input.h"
+#include "output.h"
+#include "pool.h"
+#include "session.h"
 
 // stream snapshot
 struct stream_snap {
@@ -38,33 +42,63 @@ struct stream_snap {
     // stream name
     char name[20];
 
+    // routing
+    char *session;             // session pattern
+    int primary;               // primary stream of the session
+
     // data format
     char *format_name;         // sample format name
     long sample_rate;          // sample rate
     long channels;             // channels
 
     // stream counters
+    long packets;              // packets received
     long lost;                 // total lost packets counter
+    long reordered;            // late packets restored within the window
+    long dropped;              // duplicates and packets too late for the window
     uint32_t expected;         // next expected packet number in this stream
     struct timespec ts_first;  // first packet received time
     struct timespec ts_last;   // last packet received time
     double dt_average;         // average nanoseconds between packets, EWMA
     double dt_variance;        // average variance between packets, EWMV
+    double loss;               // lost packets ratio, EWMA
+    double health;             // 1.0 for perfect stream, lower is worse
+    long timeout;              // offline timeout, msec
 
     // synchronization
     long ignore;               // ignore this stream
     long insync;               // synchronized with primary stream
     int64_t offset;            // stream offset
+    long sync_attempts;        // offset searches made
+    double sync_msec;          // time from first packet to synchronization
+    int correlated;            // synchronized by cross-correlation
+    double confidence;         // normalized correlation at offset
+    double drift_ppm;          // sender clock error against local clock
+};
+
+// session snapshot
+struct session_snap {
+    char *pattern;             // stream names pattern
+    char *pipename;            // first output pipe
+    int streams;               // streams in session
+    long lost;                 // lost frames
+    struct output_stats output;
 };
 
 struct snapshot_cell {
     struct stream_snap *ss;
     int ss_size;
     int count;
-    long lost;
+    struct session_snap *sess;
+    int sess_size;
+    int sessions;
+    long lost;                 // totals over sessions
+    struct input_stats input;
+    struct output_stats output;
+    struct pool_stats pool;
 };
 
-void httpd_update(struct stream *streams);
-int httpd(int sock);
+void httpd_update(struct session *sessions);
+int httpd(int sock, int cpu);
 
 #endif
@@ -0,0 +1,990 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/udp.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+
+#include "vban.h"
+#include "pool.h"
+#include "input.h"
+#include "uring.h"
+#include "logger.h"
+
+#define DATA_BUFFER_SIZE 1436
+#define AUX_BUFFER_SIZE 256
+
+// coalesced datagrams with UDP_GRO
+#define GRO_BUFFER_SIZE 65536
+
+// worker ring size, power of two
+#define RING_SIZE 512
+
+// io_uring provided buffers, power of two
+#define URING_BUFFERS 256
+
+// receive buffer: kernel memory per queued datagram and time to hold
+#define RCVBUF_TRUESIZE 4096
+#define RCVBUF_MSEC 250
+
+
+/*
+ * Batch of datagrams received by one recvmmsg() call
+ */
+struct batch {
+    struct mmsghdr *msgs;
+    struct iovec (*iov)[2];
+    struct sockaddr_storage *addr;
+    char (*header)[VBAN_HEADER_SIZE];
+    uint8_t (*aux)[AUX_BUFFER_SIZE];
+    char **data;
+    int size;  // batch slots
+    int count; // datagrams in batch
+    int next;  // next datagram to return
+
+    // UDP_GRO: slots hold coalesced datagrams split into segments
+    int gro;
+    struct datagram seg;  // current coalesced datagram
+    char *seg_next;       // next segment
+    char *seg_end;        // end of coalesced datagram
+    int seg_size;         // segment size
+};
+
+/*
+ * Datagram queued by a worker
+ */
+struct entry {
+    struct sockaddr_storage addr;
+    char header[VBAN_HEADER_SIZE];
+    struct vbaninfo info;
+    char *data;
+    ssize_t size;
+    unsigned ifindex;
+    struct timespec ts;
+};
+
+/*
+ * Receiver: one socket and its batch or io_uring. In worker mode it runs
+ * in its own thread and passes datagrams to the main thread through
+ * a single producer, single consumer ring.
+ */
+struct receiver {
+    int sock;
+    int engine;
+    int blocking;              // sleep in receive calls, worker mode
+    int idle;                  // nothing received since the last wait
+    struct batch batch;
+    long batches;
+    long packets;
+    long coalesced;
+    long kdrops;               // socket queue overflows, SO_RXQ_OVFL
+    int rcvbuf_min;            // initial SO_RCVBUF
+    int rcvbuf;                // current SO_RCVBUF
+
+    // io_uring engine
+    struct uring uring;
+    struct msghdr msg;         // multishot recvmsg layout
+    char *bufs[URING_BUFFERS]; // provided buffers by id
+    int bid;                   // buffer of the last datagram, -1 if none
+
+    // worker mode
+    pthread_t thread;
+    struct entry *ring;
+    unsigned head;             // written by worker
+    unsigned tail;             // written by main thread
+    long drops;                // ring overflows
+};
+
+static struct receiver *receivers = NULL;
+static int nreceivers = 0;
+static int workers = 0;
+
+// kernel timestamp to processing latency, nanoseconds
+static double latency = 0;
+static long latency_max = 0;
+
+// main thread wakeup
+static int efd = -1;
+static int waiting = 1;
+
+// datagram returned by last input_recv() in worker mode
+static struct receiver *pending = NULL;
+static int rr = 0;
+
+
+/*
+ * Parse auxiliary data: interface index, receive timestamp,
+ * kernel drops counter and UDP_GRO segment size
+ */
+static int parse_cmsg(struct msghdr *m, struct datagram *dg, int *gso)
+{
+    struct cmsghdr *cm;
+    int found_idx;
+    int found_ts;
+
+    found_ts = 0;
+    found_idx = 0;
+    for (cm = CMSG_FIRSTHDR(m); cm; cm = CMSG_NXTHDR(m, cm)) {
+        if (cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_PKTINFO) {
+            struct in_pktinfo *ipi = (void *) CMSG_DATA(cm);
+            dg->ifindex = ipi->ipi_ifindex;
+            found_idx++;
+        }
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+            memcpy(&dg->ts, CMSG_DATA(cm), sizeof(dg->ts));
+            found_ts++;
+        }
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t drops;
+
+            // total drops on this socket so far
+            memcpy(&drops, CMSG_DATA(cm), sizeof(drops));
+            if (drops > dg->receiver->kdrops) {
+                logger(LOG_DBG, "kernel dropped %ld datagrams",
+                       (long) drops - dg->receiver->kdrops);
+                __atomic_store_n(&dg->receiver->kdrops, (long) drops, __ATOMIC_RELAXED);
+            }
+        }
+        if (gso && cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO)
+            memcpy(gso, CMSG_DATA(cm), sizeof(int));
+    }
+
+    if (!found_idx) {
+        logger(LOG_ERR, "couldn't find IP_PKTINFO data in auxiliary recvmsg() data!");
+        return -1;
+    }
+
+    if (!found_ts) {
+        logger(LOG_ERR, "couldn't find SCM_TIMESTAMPNS data in auxiliary recvmsg() data!");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int batch_init(struct batch *b, int size, int gro)
+{
+    int i;
+
+    b->msgs = calloc(size, sizeof(*b->msgs));
+    b->iov = calloc(size, sizeof(*b->iov));
+    b->addr = calloc(size, sizeof(*b->addr));
+    b->header = calloc(size, sizeof(*b->header));
+    b->aux = calloc(size, sizeof(*b->aux));
+    b->data = calloc(size, sizeof(*b->data));
+
+    if (!b->msgs || !b->iov || !b->addr || !b->header || !b->aux || !b->data) {
+        logger(LOG_ERR, "cannot allocate memory!");
+        return -1;
+    }
+
+    b->size = size;
+    b->count = 0;
+    b->next = 0;
+    b->gro = gro;
+    b->seg_next = NULL;
+    b->seg_end = NULL;
+
+    // coalesced datagrams do not fit pool blocks
+    for (i = 0; gro && i < size; i++) {
+        b->data[i] = malloc(GRO_BUFFER_SIZE);
+        if (!b->data[i]) {
+            logger(LOG_ERR, "cannot allocate memory!");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Receive next batch of datagrams, returns number of datagrams received,
+ * 0 if none are queued and -1 on error
+ */
+static int batch_fill(struct receiver *r)
+{
+    struct batch *b = &r->batch;
+    int i, rc;
+
+    for (i = 0; i < b->size; i++) {
+        // replace buffers taken by input_keep()
+        if (!b->data[i]) {
+            b->data[i] = pool_get();
+            if (!b->data[i]) {
+                logger(LOG_ERR, "cannot allocate memory!");
+                return -1;
+            }
+        }
+
+        if (b->gro) {
+            b->iov[i][0].iov_base = b->data[i];
+            b->iov[i][0].iov_len = GRO_BUFFER_SIZE;
+        } else {
+            b->iov[i][0].iov_base = b->header[i];
+            b->iov[i][0].iov_len = VBAN_HEADER_SIZE;
+            b->iov[i][1].iov_base = b->data[i];
+            b->iov[i][1].iov_len = DATA_BUFFER_SIZE;
+        }
+
+        b->msgs[i].msg_hdr.msg_name = &b->addr[i];
+        b->msgs[i].msg_hdr.msg_namelen = sizeof(b->addr[i]);
+        b->msgs[i].msg_hdr.msg_iov = b->iov[i];
+        b->msgs[i].msg_hdr.msg_iovlen = b->gro ? 1 : 2;
+        b->msgs[i].msg_hdr.msg_control = b->aux[i];
+        b->msgs[i].msg_hdr.msg_controllen = AUX_BUFFER_SIZE;
+        b->msgs[i].msg_hdr.msg_flags = 0;
+        b->msgs[i].msg_len = 0;
+    }
+
+    do {
+        // wait for the first datagram (workers only), then take whatever is queued
+        rc = recvmmsg(r->sock, b->msgs, b->size,
+                      MSG_WAITFORONE | (r->blocking ? 0 : MSG_DONTWAIT), NULL);
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+
+    if (rc < 0) {
+        logger(LOG_ERR, "recvmmsg: %s", strerror(errno));
+        return -1;
+    }
+
+    __atomic_store_n(&r->batches, r->batches + 1, __ATOMIC_RELAXED);
+
+    // coalesced datagrams are counted by segments
+    if (!b->gro)
+        __atomic_store_n(&r->packets, r->packets + rc, __ATOMIC_RELAXED);
+
+    b->count = rc;
+    b->next = 0;
+
+    return rc;
+}
+
+
+/*
+ * Return next datagram from the batch: 1 on success, 0 if none, -1 on error
+ */
+static int batch_next(struct receiver *r, struct datagram *dg)
+{
+    struct batch *b = &r->batch;
+    int i, rc, gso;
+
+    // next segment of coalesced datagram
+    if (b->seg_next < b->seg_end)
+        goto segment;
+
+    if (b->next >= b->count) {
+        rc = batch_fill(r);
+        if (rc <= 0)
+            return rc;
+    }
+
+    i = b->next++;
+
+    dg->header = b->header[i];
+    dg->data = b->data[i];
+    dg->size = b->msgs[i].msg_len;
+    dg->addr = (struct sockaddr *) &b->addr[i];
+    dg->info = NULL;
+    dg->ifindex = 0;
+    dg->receiver = r;
+    dg->slot = i;
+
+    if (!b->gro)
+        return parse_cmsg(&b->msgs[i].msg_hdr, dg, NULL) < 0 ? -1 : 1;
+
+    // split coalesced datagram
+    gso = 0;
+    if (parse_cmsg(&b->msgs[i].msg_hdr, dg, &gso) < 0)
+        return -1;
+
+    if (b->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+        logger(LOG_VRB, "too long datagram received");
+        return batch_next(r, dg);
+    }
+
+    b->seg = *dg;
+    b->seg_next = b->data[i];
+    b->seg_end = b->data[i] + dg->size;
+    b->seg_size = gso > 0 ? gso : dg->size;
+
+    if (gso > 0 && dg->size > gso)
+        __atomic_store_n(&r->coalesced, r->coalesced + 1, __ATOMIC_RELAXED);
+
+segment:
+    *dg = b->seg;
+    dg->header = b->seg_next;
+    dg->data = b->seg_next + VBAN_HEADER_SIZE;
+    dg->size = b->seg_end - b->seg_next;
+    if (dg->size > b->seg_size)
+        dg->size = b->seg_size;
+
+    b->seg_next += dg->size;
+
+    __atomic_store_n(&r->packets, r->packets + 1, __ATOMIC_RELAXED);
+
+    return 1;
+}
+
+
+/*
+ * Queue multishot recvmsg, datagrams go to provided buffers
+ */
+static int uring_arm(struct receiver *r)
+{
+    struct io_uring_sqe *sqe = uring_sqe(&r->uring);
+
+    if (!sqe)
+        return -1;
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = r->sock;
+    sqe->addr = (uint64_t) (uintptr_t) &r->msg;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+
+    return 0;
+}
+
+
+static int uring_open(struct receiver *r)
+{
+    int i;
+
+    if (uring_init(&r->uring, 8, URING_BUFFERS * 2) < 0)
+        return -1;
+
+    if (uring_buf_ring(&r->uring, URING_BUFFERS, 0) < 0) {
+        uring_exit(&r->uring);
+        return -1;
+    }
+
+    // provided buffers always hold a block
+    if (pool_reserve(URING_BUFFERS) < 0) {
+        uring_exit(&r->uring);
+        return -1;
+    }
+
+    for (i = 0; i < URING_BUFFERS; i++) {
+        r->bufs[i] = pool_get();
+        if (!r->bufs[i]) {
+            logger(LOG_ERR, "cannot allocate memory!");
+            goto fail;
+        }
+        uring_buf_add(&r->uring, r->bufs[i], POOL_BLOCK_SIZE, i);
+    }
+
+    uring_buf_commit(&r->uring);
+
+    // buffer layout: io_uring_recvmsg_out, name, control, payload
+    bzero(&r->msg, sizeof(r->msg));
+    r->msg.msg_namelen = sizeof(struct sockaddr_storage);
+    r->msg.msg_controllen = AUX_BUFFER_SIZE;
+    r->bid = -1;
+
+    if (uring_arm(r) < 0 || uring_submit(&r->uring) < 0)
+        goto fail;
+
+    return 0;
+
+fail:
+    // closing the ring unregisters and unmaps provided buffers ring
+    uring_exit(&r->uring);
+
+    for (i = 0; i < URING_BUFFERS; i++)
+        if (r->bufs[i]) {
+            pool_put(r->bufs[i]);
+            r->bufs[i] = NULL;
+        }
+
+    return -1;
+}
+
+
+/*
+ * Return next datagram from io_uring: 1 on success, 0 if none, -1 on error
+ */
+static int uring_next(struct receiver *r, struct datagram *dg)
+{
+    struct io_uring_recvmsg_out *out;
+    struct io_uring_cqe *cqe;
+    struct msghdr m;
+    char *name, *control, *payload;
+    int bid, res, rc;
+    unsigned flags;
+
+    // give buffer of the previous datagram back to the kernel
+    if (r->bid >= 0) {
+        if (!r->bufs[r->bid]) {
+            r->bufs[r->bid] = pool_get();
+            if (!r->bufs[r->bid]) {
+                logger(LOG_ERR, "cannot allocate memory!");
+                return -1;
+            }
+        }
+
+        uring_buf_add(&r->uring, r->bufs[r->bid], POOL_BLOCK_SIZE, r->bid);
+        uring_buf_commit(&r->uring);
+        r->bid = -1;
+    }
+
+    while (1) {
+        cqe = uring_cqe(&r->uring);
+
+        if (!cqe) {
+            r->idle = 1;
+
+            // main thread polls ring fd, just flush pending submissions
+            if (!r->blocking)
+                rc = uring_submit(&r->uring);
+            else
+                rc = uring_wait(&r->uring, -1);
+
+            if (rc < 0) {
+                logger(LOG_ERR, "io_uring_enter: %s", strerror(errno));
+                return -1;
+            }
+
+            if (!r->blocking)
+                return 0;
+
+            continue;
+        }
+
+        if (r->idle) {
+            __atomic_store_n(&r->batches, r->batches + 1, __ATOMIC_RELAXED);
+            r->idle = 0;
+        }
+
+        res = cqe->res;
+        flags = cqe->flags;
+        uring_cqe_seen(&r->uring);
+
+        // multishot request terminated, queue it again
+        if (!(flags & IORING_CQE_F_MORE) && uring_arm(r) < 0) {
+            logger(LOG_ERR, "io_uring submission queue is full");
+            return -1;
+        }
+
+        if (res == -ENOBUFS) {
+            logger(LOG_DBG, "io_uring out of buffers");
+            continue;
+        }
+
+        if (res < 0) {
+            logger(LOG_ERR, "io_uring recvmsg: %s", strerror(-res));
+            return -1;
+        }
+
+        if (!(flags & IORING_CQE_F_BUFFER))
+            continue;
+
+        bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        r->bid = bid;
+
+        out = (void *) r->bufs[bid];
+        name = (char *) (out + 1);
+        control = name + r->msg.msg_namelen;
+        payload = control + r->msg.msg_controllen;
+
+        if (out->flags & MSG_TRUNC) {
+            logger(LOG_VRB, "too long datagram received");
+
+            // buffer untouched, give it back right away
+            uring_buf_add(&r->uring, r->bufs[bid], POOL_BLOCK_SIZE, bid);
+            uring_buf_commit(&r->uring);
+            r->bid = -1;
+            continue;
+        }
+
+        __atomic_store_n(&r->packets, r->packets + 1, __ATOMIC_RELAXED);
+
+        dg->header = payload;
+        dg->data = payload + VBAN_HEADER_SIZE;
+        dg->size = out->payloadlen;
+        dg->addr = (struct sockaddr *) name;
+        dg->info = NULL;
+        dg->ifindex = 0;
+        dg->receiver = r;
+        dg->slot = bid;
+
+        bzero(&m, sizeof(m));
+        m.msg_control = control;
+        m.msg_controllen = out->controllen;
+
+        if (parse_cmsg(&m, dg, NULL) < 0)
+            return -1;
+
+        return 1;
+    }
+}
+
+
+static int receiver_next(struct receiver *r, struct datagram *dg)
+{
+    if (r->engine == INPUT_ENGINE_URING)
+        return uring_next(r, dg);
+
+    return batch_next(r, dg);
+}
+
+
+/*
+ * Drop the rest of the batch after receive error
+ */
+static void receiver_skip(struct receiver *r)
+{
+    r->batch.next = r->batch.count;
+    r->batch.seg_next = r->batch.seg_end;
+}
+
+
+/*
+ * Nothing left from the last receive call
+ */
+static int receiver_idle(struct receiver *r)
+{
+    if (r->engine == INPUT_ENGINE_URING)
+        return !uring_cqe(&r->uring);
+
+    return r->batch.next >= r->batch.count && r->batch.seg_next >= r->batch.seg_end;
+}
+
+
+/*
+ * Wake up main thread if it is waiting for datagrams
+ */
+static void wakeup(void)
+{
+    uint64_t one = 1;
+
+    if (__atomic_exchange_n(&waiting, 0, __ATOMIC_SEQ_CST))
+        if (write(efd, &one, sizeof(one)) < 0)
+            logger(LOG_ERR, "eventfd write: %s", strerror(errno));
+}
+
+
+/*
+ * Receive worker: receive, parse and queue datagrams
+ */
+static void *worker(void *arg)
+{
+    struct receiver *r = arg;
+    struct vbaninfo info;
+    struct datagram dg;
+    struct entry *e;
+    unsigned head;
+    int rc;
+
+    while (1) {
+        rc = receiver_next(r, &dg);
+
+        if (rc == 0)
+            continue;
+
+        if (rc < 0) {
+            receiver_skip(r);
+            continue;
+        }
+
+        // parse aside, the slot may still be in use while the ring is full
+        if (vban_parse(dg.header, dg.size, &info) < 0) {
+            logger(LOG_VRB, "malformed VBAN packet received");
+            goto next;
+        }
+
+        if (info.protocol != VBAN_PROTOCOL_AUDIO) {
+            logger(LOG_VRB, "[%s] unsupporded protocol", info.stream_name);
+            goto next;
+        }
+
+        if (info.codec != VBAN_CODEC_PCM) {
+            logger(LOG_VRB, "[%s] unsupported audio codec", info.stream_name);
+            goto next;
+        }
+
+        head = r->head;
+
+        if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= RING_SIZE) {
+            // main thread is too slow, drop datagram
+            __atomic_store_n(&r->drops, r->drops + 1, __ATOMIC_RELAXED);
+            goto next;
+        }
+
+        e = &r->ring[head & (RING_SIZE - 1)];
+        e->info = info;
+        memcpy(&e->addr, dg.addr, sizeof(e->addr));
+        memcpy(e->header, dg.header, VBAN_HEADER_SIZE);
+        e->data = input_keep(&dg);
+        e->size = dg.size;
+        e->ifindex = dg.ifindex;
+        e->ts = dg.ts;
+
+        __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+
+    next:
+        // batch consumed, let main thread process it
+        if (receiver_idle(r))
+            wakeup();
+    }
+
+    return NULL;
+}
+
+
+int input_init(int *socks, int count, int threads, int engine, int gro, int size)
+{
+    pthread_attr_t attr;
+    int i, rc;
+
+    if (size < 1 || size > INPUT_BATCH_MAX) {
+        logger(LOG_ERR, "bad batch size: %d", size);
+        return -1;
+    }
+
+    receivers = calloc(count, sizeof(struct receiver));
+    if (!receivers) {
+        logger(LOG_ERR, "cannot allocate memory!");
+        return -1;
+    }
+
+    nreceivers = count;
+    workers = threads;
+
+    for (i = 0; i < count; i++) {
+        socklen_t len = sizeof(int);
+
+        receivers[i].sock = socks[i];
+        receivers[i].engine = INPUT_ENGINE_MMSG;
+        receivers[i].blocking = threads > 0;
+        receivers[i].idle = 1;
+
+        // never shrink receive buffer below system default
+        if (getsockopt(socks[i], SOL_SOCKET, SO_RCVBUF, &receivers[i].rcvbuf, &len) < 0) {
+            logger(LOG_ERR, "getsockopt(SO_RCVBUF): %s", strerror(errno));
+            return -1;
+        }
+
+        receivers[i].rcvbuf_min = receivers[i].rcvbuf;
+
+        if (engine == INPUT_ENGINE_URING) {
+            if (uring_open(&receivers[i]) == 0) {
+                receivers[i].engine = INPUT_ENGINE_URING;
+                continue;
+            }
+
+            logger(LOG_INF, "io_uring unavailable: %s, using recvmmsg()", strerror(errno));
+            engine = INPUT_ENGINE_MMSG;
+        }
+
+        if (gro && setsockopt(socks[i], SOL_UDP, UDP_GRO, &gro, sizeof(gro)) < 0) {
+            logger(LOG_INF, "UDP_GRO unavailable: %s", strerror(errno));
+            gro = 0;
+        }
+
+        if (batch_init(&receivers[i].batch, size, gro) < 0)
+            return -1;
+
+        // batch slots always hold a buffer
+        if (!gro && pool_reserve(size) < 0)
+            return -1;
+    }
+
+    if (!workers)
+        return 0;
+
+    efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (efd < 0) {
+        logger(LOG_ERR, "eventfd: %s", strerror(errno));
+        return -1;
+    }
+
+    if ((rc = pthread_attr_init(&attr))) {
+        logger(LOG_ERR, "pthread_attr_init failed: %s", strerror(rc));
+        return -1;
+    }
+
+    if ((rc = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED))) {
+        logger(LOG_ERR, "pthread_attr_setdetachstate failed: %s", strerror(rc));
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        struct receiver *r = &receivers[i];
+
+        r->ring = calloc(RING_SIZE, sizeof(struct entry));
+        if (!r->ring) {
+            logger(LOG_ERR, "cannot allocate memory!");
+            return -1;
+        }
+
+        // queued datagrams hold buffers too
+        if (pool_reserve(RING_SIZE) < 0)
+            return -1;
+
+        if ((rc = pthread_create(&r->thread, &attr, worker, r))) {
+            logger(LOG_ERR, "pthread_create failed: %s", strerror(rc));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * File descriptor to poll for input_recv() readiness
+ */
+int input_fd(void)
+{
+    if (workers)
+        return efd;
+
+    if (receivers[0].engine == INPUT_ENGINE_URING)
+        return receivers[0].uring.fd;
+
+    return receivers[0].sock;
+}
+
+
+/*
+ * Release datagram returned by previous input_recv()
+ */
+static void input_release(void)
+{
+    struct receiver *r = pending;
+    struct entry *e;
+
+    if (!r)
+        return;
+
+    e = &r->ring[r->tail & (RING_SIZE - 1)];
+
+    if (e->data)
+        pool_put(e->data);
+
+    __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+    pending = NULL;
+}
+
+
+/*
+ * Return next datagram queued by workers: 1 on success, 0 if none
+ */
+static int input_dequeue(struct datagram *dg)
+{
+    uint64_t value;
+    int i;
+
+    input_release();
+
+    while (1) {
+        // round robin over workers rings
+        for (i = 0; i < nreceivers; i++) {
+            struct receiver *r = &receivers[(rr + i) % nreceivers];
+            struct entry *e;
+
+            if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == r->tail)
+                continue;
+
+            e = &r->ring[r->tail & (RING_SIZE - 1)];
+
+            dg->header = e->header;
+            dg->data = e->data;
+            dg->size = e->size;
+            dg->addr = (struct sockaddr *) &e->addr;
+            dg->info = &e->info;
+            dg->ifindex = e->ifindex;
+            dg->ts = e->ts;
+            dg->receiver = r;
+            dg->slot = -1;
+
+            rr = (rr + i + 1) % nreceivers;
+            pending = r;
+
+            return 1;
+        }
+
+        // all rings are empty, consume old wakeups,
+        // announce waiting and check again
+        if (read(efd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+            logger(LOG_ERR, "eventfd read: %s", strerror(errno));
+
+        __atomic_store_n(&waiting, 1, __ATOMIC_SEQ_CST);
+
+        for (i = 0; i < nreceivers; i++)
+            if (__atomic_load_n(&receivers[i].head, __ATOMIC_SEQ_CST) != receivers[i].tail)
+                break;
+
+        if (i < nreceivers) {
+            __atomic_store_n(&waiting, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        // next worker batch signals input_fd()
+        return 0;
+    }
+}
+
+
+/*
+ * Return next received datagram without blocking:
+ * 1 on success, 0 if nothing is queued, -1 on error
+ */
+int input_recv(struct datagram *dg)
+{
+    struct timespec now;
+    long ns;
+    int rc;
+
+    if (workers)
+        rc = input_dequeue(dg);
+    else
+    if ((rc = receiver_next(&receivers[0], dg)) < 0)
+        receiver_skip(&receivers[0]);
+
+    if (rc <= 0)
+        return rc;
+
+    // wakeup to process latency
+    clock_gettime(CLOCK_REALTIME, &now);
+    ns = (now.tv_sec - dg->ts.tv_sec) * 1000000000L + (now.tv_nsec - dg->ts.tv_nsec);
+
+    latency += (ns - latency) / 256.0;
+    if (ns > latency_max)
+        latency_max = ns;
+
+    return rc;
+}
+
+
+/*
+ * Take ownership of the datagram payload buffer
+ */
+char *input_keep(struct datagram *dg)
+{
+    struct receiver *r = dg->receiver;
+    char *data;
+
+    if (dg->slot < 0) {
+        // queued by worker
+        struct entry *e = &r->ring[r->tail & (RING_SIZE - 1)];
+        data = e->data;
+        e->data = NULL;
+    } else
+    if (r->engine == INPUT_ENGINE_URING) {
+        // payload inside provided buffer
+        data = dg->data;
+        r->bufs[dg->slot] = NULL;
+    } else
+    if (r->batch.gro) {
+        // segment of coalesced datagram, copy it out
+        data = pool_get();
+        if (data)
+            memcpy(data, dg->data, dg->size - VBAN_HEADER_SIZE);
+    } else {
+        data = r->batch.data[dg->slot];
+        r->batch.data[dg->slot] = NULL;
+    }
+
+    return data;
+}
+
+
+/*
+ * Size socket receive buffers for the given datagram rate
+ */
+void input_rcvbuf(double pps)
+{
+    int i, size, actual;
+    socklen_t len;
+
+    size = (int) (pps * RCVBUF_MSEC / 1000.0) * RCVBUF_TRUESIZE;
+
+    for (i = 0; i < nreceivers; i++) {
+        struct receiver *r = &receivers[i];
+        int want = size > r->rcvbuf_min ? size : r->rcvbuf_min;
+
+        if (want == r->rcvbuf)
+            continue;
+
+        // kernel doubles requested value for bookkeeping overhead,
+        // SO_RCVBUFFORCE ignores rmem_max but needs CAP_NET_ADMIN
+        want /= 2;
+        if (setsockopt(r->sock, SOL_SOCKET, SO_RCVBUFFORCE, &want, sizeof(want)) < 0 &&
+            setsockopt(r->sock, SOL_SOCKET, SO_RCVBUF, &want, sizeof(want)) < 0) {
+            logger(LOG_ERR, "setsockopt(SO_RCVBUF): %s", strerror(errno));
+            continue;
+        }
+
+        len = sizeof(actual);
+        if (getsockopt(r->sock, SOL_SOCKET, SO_RCVBUF, &actual, &len) < 0) {
+            logger(LOG_ERR, "getsockopt(SO_RCVBUF): %s", strerror(errno));
+            continue;
+        }
+
+        if (actual != r->rcvbuf)
+            logger(LOG_VRB, "receive buffer %d bytes (%d requested)", actual, want * 2);
+
+        __atomic_store_n(&r->rcvbuf, actual, __ATOMIC_RELAXED);
+    }
+}
+
+
+void input_stats(struct input_stats *stats)
+{
+    int i;
+
+    stats->batches = 0;
+    stats->packets = 0;
+    stats->coalesced = 0;
+    stats->drops = 0;
+    stats->kdrops = 0;
+    stats->rcvbuf = nreceivers ? __atomic_load_n(&receivers[0].rcvbuf, __ATOMIC_RELAXED) : 0;
+
+    for (i = 0; i < nreceivers; i++) {
+        stats->batches += __atomic_load_n(&receivers[i].batches, __ATOMIC_RELAXED);
+        stats->packets += __atomic_load_n(&receivers[i].packets, __ATOMIC_RELAXED);
+        stats->coalesced += __atomic_load_n(&receivers[i].coalesced, __ATOMIC_RELAXED);
+        stats->kdrops += __atomic_load_n(&receivers[i].kdrops, __ATOMIC_RELAXED);
+        stats->drops += __atomic_load_n(&receivers[i].drops, __ATOMIC_RELAXED);
+    }
+
+    // maximum since previous call
+    stats->latency = latency;
+    stats->latency_max = latency_max;
+    latency_max = 0;
+}
@@ -0,0 +1,72 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#ifndef _INPUT_H
+#define _INPUT_H 1
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "vban.h"
+
+#define INPUT_BATCH_DEFAULT 32
+#define INPUT_BATCH_MAX 256
+#define INPUT_WORKERS_MAX 64
+
+// receive engines
+#define INPUT_ENGINE_MMSG 0
+#define INPUT_ENGINE_URING 1
+
+struct receiver;
+
+// received datagram, valid until the next input_recv() call
+struct datagram {
+    char *header;              // VBAN header
+    char *data;                // VBAN payload, inside a pool block
+    ssize_t size;              // total datagram size (header + payload)
+    struct sockaddr *addr;     // sender address
+    struct vbaninfo *info;     // parsed header, NULL if not parsed yet
+    unsigned ifindex;          // receiving interface
+    struct timespec ts;        // kernel receive timestamp
+    struct receiver *receiver; // receiver holding the buffer
+    int slot;                  // batch slot, -1 if queued by worker
+};
+
+struct input_stats {
+    long batches;              // recvmmsg() calls returned data
+    long packets;              // datagrams received
+    long coalesced;            // UDP_GRO buffers with several datagrams
+    long drops;                // datagrams dropped on full worker ring
+    long kdrops;               // datagrams dropped by kernel, socket queue full
+    long rcvbuf;               // socket receive buffer size
+    double latency;            // kernel timestamp to processing, average ns
+    long latency_max;          // kernel timestamp to processing, maximum ns
+};
+
+int input_init(int *socks, int count, int workers, int engine, int gro, int batch);
+int input_fd(void);
+int input_recv(struct datagram *dg);
+char *input_keep(struct datagram *dg);
+void input_rcvbuf(double pps);
+void input_stats(struct input_stats *stats);
+
+#endif
@@ -28,7 +28,7 @@
 
 #include "logger.h"
 
-static char buffer[16384];
+static __thread char buffer[16384];
 static int verbose;
 
 
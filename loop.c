@@ -0,0 +1,182 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+
+#include "loop.h"
+#include "logger.h"
+
+#define LOOP_EVENTS 16
+
+// per-epoll busy polling, linux 6.9+
+#ifndef EPIOCSPARAMS
+struct epoll_params {
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t prefer_busy_poll;
+    uint8_t __pad;
+};
+
+#define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
+
+#define LOOP_BUSY_POLL_BUDGET 8
+
+struct watch {
+    int fd;
+    loop_handler handler;
+    void *arg;
+    struct watch *next;
+};
+
+static int epfd = -1;
+static struct watch *watches = NULL;
+static struct watch *removed = NULL;
+
+
+int loop_init(void)
+{
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        logger(LOG_ERR, "epoll_create1: %s", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Busy poll sockets device queues in epoll_wait() for up to usecs,
+ * SO_BUSY_POLL only applies to blocking receive calls
+ */
+int loop_busypoll(unsigned usecs)
+{
+    struct epoll_params params;
+
+    bzero(&params, sizeof(params));
+    params.busy_poll_usecs = usecs;
+    params.busy_poll_budget = LOOP_BUSY_POLL_BUDGET;
+    params.prefer_busy_poll = 1;
+
+    if (ioctl(epfd, EPIOCSPARAMS, &params) < 0) {
+        logger(LOG_ERR, "epoll busy poll: %s, set net.core.busy_poll instead",
+               strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int loop_add(int fd, uint32_t events, loop_handler handler, void *arg)
+{
+    struct epoll_event ev;
+    struct watch *w;
+
+    w = malloc(sizeof(struct watch));
+    if (!w) {
+        logger(LOG_ERR, "cannot allocate memory!");
+        return -1;
+    }
+
+    w->fd = fd;
+    w->handler = handler;
+    w->arg = arg;
+
+    ev.events = events;
+    ev.data.ptr = w;
+
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        logger(LOG_ERR, "epoll_ctl: %s", strerror(errno));
+        free(w);
+        return -1;
+    }
+
+    w->next = watches;
+    watches = w;
+
+    return 0;
+}
+
+
+int loop_del(int fd)
+{
+    struct watch **pw, *w;
+
+    for (pw = &watches; *pw && (*pw)->fd != fd; pw = &(*pw)->next);
+
+    if (!(w = *pw))
+        return -1;
+
+    if (epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL) < 0)
+        logger(LOG_ERR, "epoll_ctl: %s", strerror(errno));
+
+    // event may still be pending in current epoll_wait() batch,
+    // so free it after dispatch
+    w->handler = NULL;
+    *pw = w->next;
+    w->next = removed;
+    removed = w;
+
+    return 0;
+}
+
+
+/*
+ * Dispatch events until error
+ */
+int loop_run(void)
+{
+    struct epoll_event events[LOOP_EVENTS];
+    int i, n;
+
+    while (1) {
+        n = epoll_wait(epfd, events, LOOP_EVENTS, -1);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n < 0) {
+            logger(LOG_ERR, "epoll_wait: %s", strerror(errno));
+            return -1;
+        }
+
+        for (i = 0; i < n; i++) {
+            struct watch *w = events[i].data.ptr;
+
+            if (w->handler)
+                w->handler(w->fd, events[i].events, w->arg);
+        }
+
+        while (removed) {
+            struct watch *w = removed;
+            removed = w->next;
+            free(w);
+        }
+    }
+}
@@ -0,0 +1,41 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#ifndef _LOOP_H
+#define _LOOP_H 1
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+/*
+ * epoll event loop
+ */
+
+typedef void (*loop_handler)(int fd, uint32_t events, void *arg);
+
+int loop_init(void);
+int loop_busypoll(unsigned usecs);
+int loop_add(int fd, uint32_t events, loop_handler handler, void *arg);
+int loop_del(int fd);
+int loop_run(void);
+
+#endif
@@ -23,6 +23,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -32,27 +33,122 @@
 #include <assert.h>
 #include <limits.h>
 #include <errno.h>
+#include <math.h>
 
 #include "output.h"
 #include "logger.h"
 #include "streams.h"
+#include "silence.h"
+#include "writer.h"
+#include "sample.h"
+#include "convert.h"
+#include "resample.h"
+#include "conceal.h"
+#include "vban.h"
 
 
-static int64_t outpos;
-static char *presence = NULL;
-static char *buffer = NULL;
-static long lost_total = 0;
-static long cache; // frames
+// jitter buffer: depth covers JITTER_K stddevs of packet arrival times
+#define JITTER_K 3.0
+#define OUTPUT_GAPS 16
 
-static long silent_frames;
-static long silent_frames_max;
-static char filename[PATH_MAX];
-static int fd = -1;
+// drift compensation: pipe fill controller gains, per second of fill error
+#define DRIFT_KP 0.05
+#define DRIFT_KI 0.001
 
+struct output {
+    // output cache: ring of frames, head is the frame at outpos
+    // presence, quiet, patched: one bit per frame
+    int64_t outpos;
+    uint64_t *presence;
+    uint64_t *quiet;
+    uint64_t *patched;         // from correlated backup, not bit-exact
+    int tail_patched;          // last written frame was patched
+    long fades;
+    char *context;             // last frames of the previous patch packet
+    long context_len;
+    int64_t context_end;
+    int context_silent;        // previous patch packet was silent
+    char *buffer;
+    long lost_total;
+    long cache;                // frames, depth ceiling
+    long head;
 
-static void report_lost(long lost)
+    // jitter buffer depth, frames
+    long depth;
+    long extra;
+    long packet;
+    long rate;
+
+    // recently lost frames, to find late packets that could fill them
+    struct {
+        int64_t from;
+        int64_t to;
+    } gaps[OUTPUT_GAPS];
+    int gap_next;
+    long late;
+    long late_lost;
+    long late_lost_last;
+    long late_frames;          // how late the latest such packet was
+
+    long silent_frames;
+    long silent_frames_max;
+    long format;
+    long channels;
+    char filenames[WRITER_TARGETS_MAX][PATH_MAX];
+    int opened;
+    long frame_bytes;
+
+    // packets in another format, converted
+    char *scratch;
+    long scratch_size;
+
+    // drift compensation: frames resampled on their way to the pipe
+    long drift_target;         // frames queued for the reader, 0 disables
+    struct resampler *resampler;
+    float *resample_in;
+    float *resample_out;
+    char *resampled;
+    long resample_max;         // output frames buffers hold
+    double ppm;                // primary sender clock error
+    double ratio;              // output frames per input frame
+    double integral;           // fill error integral, seconds * seconds
+    long fill;                 // last measured fill, frames, -1 unknown
+    long fill_max;             // since last update
+    double fill_sum;
+    long fill_count;
+
+    // loss concealment: frames synthesized in place of lost ones
+    int conceal_policy;
+    struct concealer *concealer;
+    int concealing;            // gap in progress, fade out of it into next frames
+    long concealed;
+    long closes;               // pipe closed on silence
+    char *recent;              // last played frames, ring, output format
+    long recent_pos;
+    long recent_count;
+    float *conceal_float;      // CONCEAL_HISTORY frames of work space
+    char *conceal_bytes;
+
+    struct writer *writer;
+};
+
+
+/*
+ * Allocate output context, idle until output_init()
+ */
+struct output *output_create(void)
 {
-    lost_total += lost;
+    return calloc(1, sizeof(struct output));
+}
+
+
+static void report_lost(struct output *out, int64_t pos, long lost)
+{
+    out->gaps[out->gap_next].from = pos;
+    out->gaps[out->gap_next].to = pos + lost;
+    out->gap_next = (out->gap_next + 1) % OUTPUT_GAPS;
+
+    out->lost_total += lost;
 
     if (lost == 1)
         logger(LOG_INF, "<out> lost 1 frame");
@@ -61,25 +157,109 @@ static void report_lost(long lost)
 }
 
 
-static int silent(const char *data, long frames, long frame_size)
+/*
+ * Set or clear bits [from, from + n) of bitmap
+ */
+static void bits_fill(uint64_t *map, long from, long n, int value)
+{
+    while (n > 0) {
+        long bit = from & 63, len = 64 - bit;
+        uint64_t mask;
+
+        if (len > n)
+            len = n;
+
+        mask = (len == 64 ? ~0ULL : (1ULL << len) - 1) << bit;
+
+        if (value)
+            map[from >> 6] |= mask;
+        else
+            map[from >> 6] &= ~mask;
+
+        from += len;
+        n -= len;
+    }
+}
+
+
+/*
+ * Length of run of bits equal to value, starting at from, up to n bits
+ */
+static long bits_run(const uint64_t *map, long from, long n, int value)
+{
+    long run = 0;
+
+    while (run < n) {
+        long bit = (from + run) & 63, len;
+        uint64_t word = map[(from + run) >> 6];
+
+        if (!value)
+            word = ~word;
+
+        word >>= bit;
+
+        // fast path: rest of the word matches
+        if (word == ~0ULL >> bit) {
+            run += 64 - bit;
+            continue;
+        }
+
+        len = __builtin_ctzll(~word);
+        run += len;
+        break;
+    }
+
+    return run < n ? run : n;
+}
+
+
+static inline int bit(const uint64_t *map, long idx)
+{
+    return map[idx >> 6] >> (idx & 63) & 1;
+}
+
+
+/*
+ * Ring index of the frame pos frames after the head
+ */
+static inline long ring(struct output *out, long pos)
+{
+    long idx = out->head + pos;
+
+    return idx < out->cache ? idx : idx - out->cache;
+}
+
+
+/*
+ * Drop frames from the ring head
+ */
+static void skip(struct output *out, long frames)
 {
-    long size, i;
+    long len = out->cache - out->head;
+
+    if (len > frames)
+        len = frames;
 
-    for (i = 0, size = frames * frame_size; i < size; i++)
-        if (data[i] != 0)
-            return 0;
+    bits_fill(out->presence, out->head, len, 0);
+    bits_fill(out->patched, out->head, len, 0);
+    if (len < frames) {
+        bits_fill(out->presence, 0, frames - len, 0);
+        bits_fill(out->patched, 0, frames - len, 0);
+    }
 
-    return 1;
+    out->head = ring(out, frames);
 }
 
 
-int output_init(char *pipename, struct stream *stream, long silent_secs)
+/*
+ * Expand pipe name pattern: %f format, %r rate, %c channels
+ */
+static void expand(char *filename, const char *pipename, struct stream *stream, long format)
 {
-    char *s = pipename;
+    const char *s = pipename;
     char *d = filename;
     size_t l;
 
-    // create filename
     for (; *s && d - filename < PATH_MAX - 1; s++) {
         switch (*s) {
             case '%':
@@ -89,7 +269,7 @@ int output_init(char *pipename, struct stream *stream, long silent_secs)
                         *(d++) = *s;
                         break;
                     case 'f':
-                        d += snprintf(d, l, "%s", stream->format_name);
+                        d += snprintf(d, l, "%s", vban_format_name(format));
                         break;
                     case 'r':
                         d += snprintf(d, l, "%ld", stream->sample_rate);
@@ -108,173 +288,813 @@ int output_init(char *pipename, struct stream *stream, long silent_secs)
     }
 
     *d = '\0';
+}
 
-    // cache size
-    cache = stream->frames * BUFFER_OUT_PACKETS;
+
+int output_init(struct output *out, char **pipenames, int count, struct stream *stream,
+                long format, long silent_secs, long latency_msec, long drift_msec,
+                int conceal)
+{
+    const char *names[WRITER_TARGETS_MAX];
+    int i;
+
+    // still running for the previous primary, ring is sized per stream
+    if (out->writer && output_done(out) < 0)
+        return -1;
+
+    // sample format written to pipes, stream's one by default
+    out->format = format < 0 ? stream->format : format;
+    out->channels = stream->channels;
+    out->frame_bytes = sample_size(out->format) * out->channels;
+
+    // create filenames
+    for (i = 0; i < count && i < WRITER_TARGETS_MAX; i++) {
+        expand(out->filenames[i], pipenames[i], stream, out->format);
+        names[i] = out->filenames[i];
+    }
+
+    // cache size is the depth ceiling, at least one packet
+    out->rate = stream->sample_rate;
+    out->packet = stream->frames;
+    out->cache = latency_msec * out->rate / 1000;
+    if (out->cache < out->packet)
+        out->cache = out->packet;
+
+    out->depth = out->packet * BUFFER_OUT_PACKETS;
+    if (out->depth > out->cache)
+        out->depth = out->cache;
+    out->extra = 0;
+
+    memset(out->gaps, 0, sizeof(out->gaps));
+    out->gap_next = 0;
 
     // N seconds of silent frames to close the pipe
-    silent_frames_max = silent_secs * stream->sample_rate;
-    silent_frames = 0;
-    fd = -1;
+    out->silent_frames_max = silent_secs * stream->sample_rate;
+    out->silent_frames = 0;
+    out->opened = 0;
+
+    // reader fill level to keep, at least a packet
+    out->drift_target = drift_msec * out->rate / 1000;
+    if (drift_msec && out->drift_target < out->packet)
+        out->drift_target = out->packet;
+    out->ratio = 1.0;
+    out->integral = 0;
+    out->fill = -1;
+    out->fill_max = -1;
+    out->fill_sum = 0;
+    out->fill_count = 0;
+
+    out->conceal_policy = conceal;
+    out->concealing = 0;
+    out->recent_pos = 0;
+    out->recent_count = 0;
+
+    out->writer = writer_start(names, i);
+
+    return out->writer ? 0 : -1;
+}
+
+
+int output_done(struct output *out)
+{
+    writer_stop(out->writer);
+    out->writer = NULL;
+
+    if (out->buffer)
+        free(out->buffer);
+
+    if (out->presence)
+        free(out->presence);
+
+    if (out->quiet)
+        free(out->quiet);
+
+    if (out->patched)
+        free(out->patched);
+
+    if (out->context)
+        free(out->context);
+
+    if (out->scratch)
+        free(out->scratch);
+
+    resampler_free(out->resampler);
+    concealer_free(out->concealer);
+
+    if (out->recent)
+        free(out->recent);
+
+    if (out->conceal_float)
+        free(out->conceal_float);
+
+    if (out->conceal_bytes)
+        free(out->conceal_bytes);
+
+    if (out->resample_in)
+        free(out->resample_in);
+
+    if (out->resample_out)
+        free(out->resample_out);
+
+    if (out->resampled)
+        free(out->resampled);
+
+    out->buffer = NULL;
+    out->presence = NULL;
+    out->quiet = NULL;
+    out->patched = NULL;
+    out->context = NULL;
+    out->scratch = NULL;
+    out->scratch_size = 0;
+    out->resampler = NULL;
+    out->resample_in = NULL;
+    out->resample_out = NULL;
+    out->resampled = NULL;
+    out->resample_max = 0;
+    out->drift_target = 0;
+    out->ppm = 0;
+    out->ratio = 1.0;
+    out->concealer = NULL;
+    out->recent = NULL;
+    out->conceal_float = NULL;
+    out->conceal_bytes = NULL;
+    out->concealed = 0;
+    out->closes = 0;
+    out->context_len = 0;
+    out->tail_patched = 0;
+    out->fades = 0;
+    out->lost_total = 0;
+    out->late = 0;
+    out->late_lost = 0;
+    out->late_lost_last = 0;
+    out->late_frames = 0;
+    out->cache = 0;
 
     return 0;
 }
 
 
-int output_done(void)
+/*
+ * Length of run of set (value 1) or clear (value 0) bits in the ring
+ * from position pos, up to n frames
+ */
+static long span(struct output *out, const uint64_t *map, long pos, long n, int value)
 {
-    if (fd >= 0 && close(fd))
-        return -1;
+    long idx = ring(out, pos), len = out->cache - idx, i;
+
+    if (len > n)
+        len = n;
+
+    i = bits_run(map, idx, len, value);
+    if (i == len && len < n)
+        i += bits_run(map, 0, n - len, value);
+
+    return i;
+}
+
+
+/*
+ * Same from the head
+ */
+static long run(struct output *out, const uint64_t *map, long n, int value)
+{
+    return span(out, map, 0, n, value);
+}
+
+
+/*
+ * Copy frames to the ring at position pos and mark them present
+ */
+static void copy(struct output *out, long pos, const char *data, long frames, long frame_size,
+                 int silent, int patch)
+{
+    long idx = ring(out, pos), len;
+
+    // up to two segments: till the end of ring and from its start
+    len = out->cache - idx;
+    if (len > frames)
+        len = frames;
+
+    memcpy(out->buffer + idx * frame_size, data, len * frame_size);
+    bits_fill(out->presence, idx, len, 1);
+    bits_fill(out->quiet, idx, len, silent);
+    bits_fill(out->patched, idx, len, patch);
+
+    if (len < frames) {
+        memcpy(out->buffer, data + len * frame_size, (frames - len) * frame_size);
+        bits_fill(out->presence, 0, frames - len, 1);
+        bits_fill(out->quiet, 0, frames - len, silent);
+        bits_fill(out->patched, 0, frames - len, patch);
+    }
+}
+
+
+/*
+ * Mix frames in the ring at position pos with data, t rises linearly
+ * over n frames: ring into data if in, data into ring otherwise
+ */
+static void blend(struct output *out, long pos, const char *data, long n,
+                  long frame_size, int in)
+{
+    long size = sample_size(out->format), i, c;
+
+    if (!size || n <= 0)
+        return;
+
+    for (i = 0; i < n; i++, data += frame_size) {
+        char *p = out->buffer + ring(out, pos + i) * frame_size;
+        double t = (double) (i + 1) / (double) (n + 1);
+
+        for (c = 0; c < out->channels; c++) {
+            double r = sample_get(p + c * size, out->format);
+            double d = sample_get(data + c * size, out->format);
+
+            sample_put(p + c * size, out->format, in ? r + (d - r) * t : d + (r - d) * t);
+        }
+    }
+}
+
 
-    if (buffer)
-        free(buffer);
+/*
+ * Crossfade between exact and patched frames, the mix is quiet only
+ * if both sides are
+ */
+static void crossfade(struct output *out, long pos, const char *data, long n,
+                      long frame_size, int in, int silent)
+{
+    long i;
+
+    if (n > 0)
+        out->fades++;
+
+    blend(out, pos, data, n, frame_size, in);
+
+    if (!silent)
+        for (i = 0; i < n; i++)
+            out->quiet[ring(out, pos + i) >> 6] &= ~(1ULL << (ring(out, pos + i) & 63));
+}
 
-    if (presence)
-        free(presence);
 
-    buffer = NULL;
-    presence = NULL;
-    lost_total = 0;
+/*
+ * Store frames in the ring at position pos from the head. Exact frames
+ * replace patched ones, fading over from patched neighbours. Patches
+ * only fill missing frames, fading in and out of exact neighbours, the
+ * tail of the previous patch packet serves a gap at the packet start.
+ */
+static void store(struct output *out, long pos, const char *data, long frames,
+                  long frame_size, int patch)
+{
+    long i, n, lead = 0, trail = 0, max = frames / 2;
+    int silent = 0;
+
+    // evaluate silence once per packet
+    if (out->silent_frames_max > 0)
+        silent = silence_detect(data, frames * out->channels, out->format);
+
+    if (max > OUTPUT_FADE_FRAMES)
+        max = OUTPUT_FADE_FRAMES;
+
+    if (!patch) {
+        // patched frames replaced after a patched one
+        if (pos > 0 ? bit(out->patched, ring(out, pos - 1)) : out->tail_patched)
+            while (lead < max && bit(out->patched, ring(out, pos + lead)))
+                lead++;
+
+        // patched frames replaced before a patched one
+        if (pos + frames < out->cache && bit(out->patched, ring(out, pos + frames)))
+            while (trail < max && bit(out->patched, ring(out, pos + frames - trail - 1)))
+                trail++;
+
+        crossfade(out, pos, data, lead, frame_size, 1, silent);
+        copy(out, pos + lead, data + lead * frame_size, frames - lead - trail,
+             frame_size, silent, 0);
+        crossfade(out, pos + frames - trail, data + (frames - trail) * frame_size,
+                  trail, frame_size, 0, silent);
+
+        for (i = 0; i < lead; i++)
+            out->patched[ring(out, pos + i) >> 6] &= ~(1ULL << (ring(out, pos + i) & 63));
+        for (i = frames - trail; i < frames; i++)
+            out->patched[ring(out, pos + i) >> 6] &= ~(1ULL << (ring(out, pos + i) & 63));
+        return;
+    }
+
+    for (i = 0; i < frames; i += n) {
+        n = span(out, out->presence, pos + i, frames - i, 1);
+
+        if (n) {
+            // the patch before fades into these exact frames
+            trail = n < OUTPUT_FADE_FRAMES ? n : OUTPUT_FADE_FRAMES;
+            if ((pos + i > 0 ? bit(out->patched, ring(out, pos + i - 1)) : out->tail_patched) &&
+                !bit(out->patched, ring(out, pos + i)))
+                crossfade(out, pos + i, data + i * frame_size, trail, frame_size, 0, silent);
+            continue;
+        }
+
+        n = span(out, out->presence, pos + i, frames - i, 0);
+
+        // exact frames before the gap fade into the patch, from this
+        // packet or the end of the previous one when the gap starts it
+        if (pos + i > 0 && bit(out->presence, ring(out, pos + i - 1)) &&
+            !bit(out->patched, ring(out, pos + i - 1))) {
+            if (i) {
+                lead = i < OUTPUT_FADE_FRAMES ? i : OUTPUT_FADE_FRAMES;
+                crossfade(out, pos + i - lead, data + (i - lead) * frame_size, lead, frame_size, 1,
+                          silent);
+            } else if (out->context_end == out->outpos + pos) {
+                lead = out->context_len < pos ? out->context_len : pos;
+                crossfade(out, pos - lead, out->context + (out->context_len - lead) * frame_size,
+                          lead, frame_size, 1, out->context_silent);
+            }
+        }
+
+        copy(out, pos + i, data + i * frame_size, n, frame_size, silent, 1);
+    }
+
+    // keep the tail for a gap starting the next packet
+    if (!out->context)
+        out->context = malloc(OUTPUT_FADE_FRAMES * frame_size);
+
+    if (out->context) {
+        out->context_len = frames < OUTPUT_FADE_FRAMES ? frames : OUTPUT_FADE_FRAMES;
+        out->context_end = out->outpos + pos + frames;
+        out->context_silent = silent;
+        memcpy(out->context, data + (frames - out->context_len) * frame_size,
+               out->context_len * frame_size);
+    }
+}
+
+
+/*
+ * Resample frames to follow the reader's clock, iov is replaced with the
+ * result. Returns iov count, 0 if nothing came out
+ */
+static int resampled(struct output *out, struct iovec *iov, int iovcnt)
+{
+    long frames = 0, max, n, i;
+    float *in;
+
+    for (i = 0; i < iovcnt; i++)
+        frames += iov[i].iov_len / out->frame_bytes;
+
+    // output frames for any allowed ratio
+    max = frames + frames / 100 + 2;
+
+    if (max > out->resample_max) {
+        float *fin = realloc(out->resample_in, max * out->channels * sizeof(float));
+        float *fout = fin ? realloc(out->resample_out, max * out->channels * sizeof(float)) : NULL;
+        char *bytes = fout ? realloc(out->resampled, max * out->frame_bytes) : NULL;
+
+        if (fin)
+            out->resample_in = fin;
+        if (fout)
+            out->resample_out = fout;
+        if (bytes)
+            out->resampled = bytes;
+
+        // cannot resample, play as is
+        if (!bytes)
+            return iovcnt;
+
+        out->resample_max = max;
+    }
+
+    if (!out->resampler) {
+        out->resampler = resampler_create(out->channels);
+        if (!out->resampler)
+            return iovcnt;
+    }
+
+    for (i = 0, in = out->resample_in; i < iovcnt; i++) {
+        n = iov[i].iov_len / out->frame_bytes * out->channels;
+        convert(in, VBAN_DATATYPE_FLOAT32, iov[i].iov_base, out->format, n);
+        in += n;
+    }
+
+    n = resample(out->resampler, out->resample_out, max, out->resample_in, frames, out->ratio);
+    convert(out->resampled, out->format, out->resample_out, VBAN_DATATYPE_FLOAT32,
+            n * out->channels);
+
+    iov[0].iov_base = out->resampled;
+    iov[0].iov_len = n * out->frame_bytes;
+
+    return n ? 1 : 0;
+}
+
+
+/*
+ * Keep last played frames for concealment analysis
+ */
+static void remember(struct output *out, const struct iovec *iov, int iovcnt)
+{
+    long frames, skip, len, i;
+
+    for (i = 0; i < iovcnt; i++) {
+        const char *data = iov[i].iov_base;
+
+        frames = iov[i].iov_len / out->frame_bytes;
+        skip = frames > CONCEAL_HISTORY ? frames - CONCEAL_HISTORY : 0;
+
+        for (data += skip * out->frame_bytes, frames -= skip; frames > 0; frames -= len) {
+            len = CONCEAL_HISTORY - out->recent_pos;
+            if (len > frames)
+                len = frames;
+
+            memcpy(out->recent + out->recent_pos * out->frame_bytes, data, len * out->frame_bytes);
+            data += len * out->frame_bytes;
+
+            out->recent_pos = (out->recent_pos + len) % CONCEAL_HISTORY;
+            out->recent_count += len;
+        }
+    }
+
+    if (out->recent_count > CONCEAL_HISTORY)
+        out->recent_count = CONCEAL_HISTORY;
+}
+
+
+/*
+ * Fill lost frames at the ring head with concealment, 0 on success
+ */
+static int conceal_gap(struct output *out, long frames)
+{
+    long done, n;
+
+    if (!out->concealer) {
+        out->concealer = concealer_create(out->conceal_policy, out->channels, out->rate);
+        out->conceal_float = malloc(CONCEAL_HISTORY * out->channels * sizeof(float));
+        out->conceal_bytes = malloc(CONCEAL_HISTORY * out->frame_bytes);
+
+        if (!out->concealer || !out->conceal_float || !out->conceal_bytes) {
+            logger(LOG_ERR, "<out> cannot allocate memory, concealment disabled");
+            out->conceal_policy = CONCEAL_NONE;
+            return -1;
+        }
+    }
+
+    if (!out->concealing) {
+        // analyze played frames, oldest first
+        long count = out->recent ? out->recent_count : 0;
+        long first = (out->recent_pos + CONCEAL_HISTORY - count) % CONCEAL_HISTORY;
+        long len = CONCEAL_HISTORY - first < count ? CONCEAL_HISTORY - first : count;
+
+        if (count) {
+            convert(out->conceal_float, VBAN_DATATYPE_FLOAT32,
+                    out->recent + first * out->frame_bytes, out->format, len * out->channels);
+            convert(out->conceal_float + len * out->channels, VBAN_DATATYPE_FLOAT32,
+                    out->recent, out->format, (count - len) * out->channels);
+        }
+
+        conceal_start(out->concealer, out->conceal_float, count);
+        out->concealing = 1;
+    }
+
+    for (done = 0; done < frames; done += n) {
+        n = frames - done < CONCEAL_HISTORY ? frames - done : CONCEAL_HISTORY;
+
+        conceal(out->concealer, out->conceal_float, n);
+        convert(out->conceal_bytes, out->format, out->conceal_float, VBAN_DATATYPE_FLOAT32,
+                n * out->channels);
+        copy(out, done, out->conceal_bytes, n, out->frame_bytes,
+             out->conceal_policy == CONCEAL_SILENCE, 0);
+    }
+
+    out->concealed += frames;
 
     return 0;
 }
 
 
-void output_play(int64_t ts, const char *data, long frames, long frame_size)
+/*
+ * Frames are back after concealment: fade from its continuation into them
+ */
+static void resume(struct output *out, long frames)
 {
-    long size, lost, off, len, i;
+    long n = frames < OUTPUT_FADE_FRAMES ? frames : OUTPUT_FADE_FRAMES;
 
-    size = frames * frame_size;
+    conceal(out->concealer, out->conceal_float, n);
+    convert(out->conceal_bytes, out->format, out->conceal_float, VBAN_DATATYPE_FLOAT32,
+            n * out->channels);
+    blend(out, 0, out->conceal_bytes, n, out->frame_bytes, 0);
 
-    assert(frames <= cache);
+    out->concealing = 0;
+}
 
-    if (!buffer) {
-        buffer = malloc(cache * frame_size);
-        if (!buffer)
+
+/*
+ * Write frames from the ring head to the pipe and advance the head
+ */
+static void flush(struct output *out, long frames, long frame_size)
+{
+    struct iovec iov[2];
+    int iovcnt = 1;
+    long len;
+
+    len = out->cache - out->head;
+    if (len > frames)
+        len = frames;
+
+    iov[0].iov_base = out->buffer + out->head * frame_size;
+    iov[0].iov_len = len * frame_size;
+
+    if (len < frames) {
+        iov[1].iov_base = out->buffer;
+        iov[1].iov_len = (frames - len) * frame_size;
+        iovcnt = 2;
+    }
+
+    if (out->recent)
+        remember(out, iov, iovcnt);
+
+    if (out->silent_frames_max > 0 && run(out, out->quiet, frames, 1) == frames) {
+        if (out->silent_frames < out->silent_frames_max)
+            out->silent_frames += frames;
+    } else
+        out->silent_frames = 0;
+
+    if (out->drift_target && out->opened) {
+        // reader fill level for the drift controller
+        long fill = writer_fill(out->writer);
+
+        out->fill = fill < 0 ? -1 : fill / frame_size;
+        if (out->fill >= 0) {
+            out->fill_sum += out->fill;
+            out->fill_count++;
+            if (out->fill > out->fill_max)
+                out->fill_max = out->fill;
+        }
+    }
+
+    if (out->silent_frames > out->silent_frames_max) {
+        if (out->opened) {
+            writer_open(out->writer, 0);
+            out->opened = 0;
+            out->closes++;
+
+            logger(LOG_INF, "<out> silence detected: %ld frames, pipe closed", out->silent_frames);
+        }
+    } else {
+        // writer thread opens the pipe
+        if (!out->opened) {
+            writer_open(out->writer, 1);
+            out->opened = 1;
+        }
+
+        if (out->drift_target)
+            iovcnt = resampled(out, iov, iovcnt);
+
+        if (iovcnt && writer_put(out->writer, iov, iovcnt) < 0)
+            // report overrun can be very noisy if source suspended
+            logger(LOG_DBG, "output overrun: %ld frames", frames);
+    }
+
+    out->tail_patched = bit(out->patched, ring(out, frames - 1));
+    skip(out, frames);
+}
+
+
+void output_play(struct output *out, int64_t ts, const char *data, long frames,
+                 long format, int patch)
+{
+    long frame_size = out->frame_bytes, lost, off, len, i;
+
+    assert(frames <= out->cache);
+
+    if (format != out->format) {
+        if (out->scratch_size < frames * frame_size) {
+            char *scratch = realloc(out->scratch, frames * frame_size);
+            if (!scratch)
+                return;
+
+            out->scratch = scratch;
+            out->scratch_size = frames * frame_size;
+        }
+
+        convert(out->scratch, out->format, data, format, frames * out->channels);
+        data = out->scratch;
+    }
+
+    if (!out->buffer) {
+        out->buffer = malloc(out->cache * frame_size);
+        if (!out->buffer)
             return;
     }
 
-    if (!presence) {
-        presence = malloc(cache);
-        if (!presence)
+    // played frames history, concealment starts from silence without it
+    if (!out->recent && out->conceal_policy >= CONCEAL_REPEAT)
+        out->recent = malloc(CONCEAL_HISTORY * frame_size);
+
+    if (!out->quiet) {
+        out->quiet = calloc((out->cache + 63) / 64, sizeof(uint64_t));
+        if (!out->quiet)
             return;
+    }
 
-        memcpy(buffer, data, size);
-        memset(presence, 1, frames);
-        if (frames < cache)
-            bzero(presence + frames, cache - frames);
-        outpos = ts;
+    if (!out->patched) {
+        out->patched = calloc((out->cache + 63) / 64, sizeof(uint64_t));
+        if (!out->patched)
+            return;
     }
 
-    if (ts <= outpos) {
-        if (ts + frames <= outpos)
-            // nothing to play in this packet
+    if (!out->presence) {
+        out->presence = calloc((out->cache + 63) / 64, sizeof(uint64_t));
+        if (!out->presence)
             return;
 
-        off = (long) (outpos - ts);
-        len = frames - off;
+        out->head = 0;
+        out->outpos = ts;
+    }
 
-        memcpy(buffer, data + off * frame_size, len * frame_size);
-        memset(presence, 1, len);
+    if (ts < out->outpos) {
+        int64_t end = ts + frames < out->outpos ? ts + frames : out->outpos;
 
-        return;
+        // late packet, could it fill lost frames?
+        out->late++;
+        for (i = 0; i < OUTPUT_GAPS; i++)
+            if (ts < out->gaps[i].to && end > out->gaps[i].from) {
+                out->late_lost++;
+                out->late_frames = (long) (out->outpos - ts);
+                break;
+            }
     }
 
-    if (ts + frames <= outpos + cache) {
-        off = (long) (ts - outpos);
+    if (ts <= out->outpos) {
+        if (ts + frames <= out->outpos)
+            // nothing to play in this packet
+            return;
+
+        off = (long) (out->outpos - ts);
+        store(out, 0, data + off * frame_size, frames - off, frame_size, patch);
 
-        memcpy(buffer + off * frame_size, data, size);
-        memset(presence + off, 1, frames);
+        return;
+    }
 
+    if (ts + frames <= out->outpos + out->depth) {
+        store(out, (long) (ts - out->outpos), data, frames, frame_size, patch);
         return;
     }
 
-    len = (long) ((ts - outpos) + (int64_t) (frames - cache));
-    outpos += len;
+    len = (long) ((ts - out->outpos) + (int64_t) (frames - out->depth));
+    out->outpos += len;
 
-    // play frames from the start of buffer
+    // play frames from the ring head
     lost = 0;
     while (len) {
-        if (*presence) {
-            // calc length of block to play
-            for (i = 1; i < len && i < cache && presence[i]; i++);
-
-            if (silent_frames_max > 0 && silent(buffer, i, frame_size)) {
-                if (silent_frames < silent_frames_max)
-                    silent_frames += i;
-            } else
-                silent_frames = 0;
-
-            if (silent_frames > silent_frames_max) {
-                if (fd >= 0) {
-                    close(fd);
-                    fd = -1;
-
-                    logger(LOG_INF, "<out> silence detected: %ld frames, pipe closed", silent_frames);
-                }
-            } else {
-                if (fd == -1) {
-                    if ((fd = open(filename, O_WRONLY | O_NONBLOCK | O_CLOEXEC)) < 0) {
-                        logger(LOG_ERR, "open failed: %s", strerror(errno));
-                        exit(1);
-                    }
+        i = run(out, out->presence, len < out->cache ? len : out->cache, 1);
 
-                    logger(LOG_INF, "<out> end of silence, pipe opened: %s", filename);
-                }
-
-                if (write(fd, buffer, i * frame_size) < 0) {
-                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                        // report overrun can be very noisy if source suspended
-                        logger(LOG_DBG, "output overrun: %ld frames", i);
-                    } else {
-                        logger(LOG_ERR, "write failed: %s", strerror(errno));
-                        exit(1);
-                    }
-                }
-            }
-
-            if (i < cache) {
-                memmove(buffer, buffer + i * frame_size, (cache - i) * frame_size);
-                memmove(presence, presence + i, cache - i);
-                bzero(presence + cache - i, i);
-            } else {
-                bzero(presence, cache);
-            }
+        if (i) {
+            // play block of present frames
+            if (out->concealing)
+                resume(out, i);
+            flush(out, i, frame_size);
             len -= i;
         } else {
             // calc length of lost block
-            for (i = 1; i < len && i < cache && !presence[i]; i++);
+            i = run(out, out->presence, len < out->cache ? len : out->cache, 0);
 
-            if (i < cache) {
-                memmove(buffer, buffer + i * frame_size, (cache - i) * frame_size);
-                memmove(presence, presence + i, cache - i);
-                bzero(presence + cache - i, i);
-                report_lost(i);
+            if (i < out->cache) {
+                // keep the timeline: play concealed frames instead
+                if (out->conceal_policy != CONCEAL_NONE && conceal_gap(out, i) == 0)
+                    flush(out, i, frame_size);
+                else
+                    skip(out, i);
+                out->tail_patched = 0;
+                report_lost(out, out->outpos - len, i);
                 len -= i;
             } else {
-                // lost whole cache
+                // lost whole cache, stream was gone
                 lost = len;
                 len = 0;
+                out->tail_patched = 0;
+                out->concealing = 0;
             }
         }
     }
 
     if (lost)
-        report_lost(lost);
+        report_lost(out, out->outpos - lost, lost);
 
-    off = (long) (ts - outpos);
-    memcpy(buffer + off * frame_size, data, size);
-    memset(presence + off, 1, frames);
+    store(out, (long) (ts - out->outpos), data, frames, frame_size, patch);
 }
 
 
-void output_move(int64_t offset)
+void output_move(struct output *out, int64_t offset)
 {
-    outpos += offset;
+    int i;
+
+    out->outpos += offset;
+    out->context_end += offset;
+
+    for (i = 0; i < OUTPUT_GAPS; i++) {
+        out->gaps[i].from += offset;
+        out->gaps[i].to += offset;
+    }
 }
 
 
-long output_lost(void)
+/*
+ * Adapt jitter buffer depth once per second to arrival jitter (stddev,
+ * nanoseconds) and grow it by the lateness of packets that missed lost frames.
+ * Depth grows at once and shrinks slowly.
+ */
+void output_adapt(struct output *out, double jitter)
 {
-    return lost_total;
+    long target, step = out->packet / 16 + 1;
+
+    if (!out->cache)
+        return;
+
+    if (out->late_lost != out->late_lost_last)
+        out->extra += out->late_frames > out->packet ? out->late_frames : out->packet;
+    else
+        out->extra -= step;
+
+    if (out->extra > out->cache)
+        out->extra = out->cache;
+    if (out->extra < 0)
+        out->extra = 0;
+
+    out->late_lost_last = out->late_lost;
+
+    target = out->packet + out->extra +
+             (long) (JITTER_K * jitter * (double) out->rate / 1000000000.0);
+    if (target > out->cache)
+        target = out->cache;
+
+    if (target < out->depth - step)
+        target = out->depth - step;
+
+    if (target != out->depth)
+        logger(LOG_DBG, "<out> jitter buffer depth %ld frames", target);
+
+    out->depth = target;
+}
+
+
+/*
+ * Update resampling ratio once per second: follow primary sender clock
+ * error (ppm against local clock) and steer reader fill level to target
+ */
+void output_drift(struct output *out, double ppm)
+{
+    double limit = OUTPUT_DRIFT_MAX_PPM / 1000000.0, ratio, error;
+
+    out->ppm = ppm;
+
+    if (!out->drift_target)
+        return;
+
+    ratio = 1.0 - ppm / 1000000.0;
+
+    // a reader taking everything at once has no clock to follow
+    if (out->fill_count && out->fill_max >= out->packet / 2) {
+        error = (out->fill_sum / out->fill_count - out->drift_target) / out->rate;
+
+        out->integral += error;
+        if (DRIFT_KI * fabs(out->integral) > limit)
+            out->integral = copysign(limit / DRIFT_KI, out->integral);
+
+        ratio -= DRIFT_KP * error;
+    }
+
+    ratio -= DRIFT_KI * out->integral;
+
+    if (ratio > 1.0 + limit)
+        ratio = 1.0 + limit;
+    if (ratio < 1.0 - limit)
+        ratio = 1.0 - limit;
+
+    out->ratio = ratio;
+    out->fill_sum = 0;
+    out->fill_count = 0;
+    out->fill_max = -1;
+
+    logger(LOG_DBG, "<out> drift %.1f ppm, fill %ld frames, ratio %.6f", ppm, out->fill, ratio);
+}
+
+
+long output_lost(struct output *out)
+{
+    return out->lost_total;
+}
+
+
+void output_stats(struct output *out, struct output_stats *stats)
+{
+    struct writer_stats ws = { 0, 0 };
+
+    if (out->writer)
+        writer_stats(out->writer, &ws);
+
+    stats->overrun = out->frame_bytes ? ws.dropped / out->frame_bytes : 0;
+    stats->short_writes = ws.short_writes;
+    stats->depth = out->cache ? out->depth : 0;
+    stats->capacity = out->cache;
+    stats->late = out->late;
+    stats->late_lost = out->late_lost;
+    stats->crossfades = out->fades;
+    stats->drift_ppm = out->ppm;
+    stats->ratio = out->cache ? out->ratio : 1.0;
+    stats->fill = out->drift_target && out->opened ? out->fill : -1;
+    stats->concealed = out->concealed;
+    stats->closes = out->closes;
 }
@@ -26,14 +26,42 @@
 #include <stdint.h>
 #include "streams.h"
 
-#define BUFFER_OUT_PACKETS 2
+#define BUFFER_OUT_PACKETS 2     // initial jitter buffer depth
+#define OUTPUT_SILENT_SECS 5
+#define OUTPUT_LATENCY_MSEC 50   // jitter buffer depth ceiling
+#define OUTPUT_FADE_FRAMES 64    // crossfade between exact and patched frames
+#define OUTPUT_DRIFT_MAX_PPM 1000 // resampling ratio correction limit
 
-int output_init(char *pipename, struct stream *stream, long silent_secs);
-int output_done(void);
+struct output_stats {
+    long depth;                  // jitter buffer depth, frames
+    long capacity;               // jitter buffer ceiling, frames
+    long late;                   // packets behind output position
+    long late_lost;              // late packets for frames already lost
+    long overrun;                // frames dropped, pipe full or unavailable
+    long short_writes;           // partial pipe writes
+    long crossfades;             // joins of exact and correlated backup frames
+    double drift_ppm;            // primary sender clock error against local clock
+    double ratio;                // resampling ratio, output frames per input frame
+    long fill;                   // frames queued for the pipe reader, -1 unknown
+    long concealed;              // lost frames synthesized, counted in lost too
+    long closes;                 // pipe closed on silence
+};
 
-void output_play(int64_t ts, const char *data, long frames, long frame_size);
-void output_move(int64_t offset);
+struct output;
 
-long output_lost();
+struct output *output_create(void);
+int output_init(struct output *out, char **pipenames, int count, struct stream *stream,
+                long format, long silent_secs, long latency_msec, long drift_msec,
+                int conceal);
+int output_done(struct output *out);
+
+void output_play(struct output *out, int64_t ts, const char *data, long frames,
+                 long format, int patch);
+void output_move(struct output *out, int64_t offset);
+void output_adapt(struct output *out, double jitter);
+void output_drift(struct output *out, double ppm);
+
+long output_lost(struct output *out);
+void output_stats(struct output *out, struct output_stats *stats);
 
 #endif
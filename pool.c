@@ -0,0 +1,176 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "pool.h"
+#include "logger.h"
+
+#define SLAB_SIZE (2L * 1024L * 1024L)
+#define SLAB_BLOCKS (SLAB_SIZE / POOL_BLOCK_SIZE)
+
+// spare blocks kept above reservations
+#define POOL_SPARE 32
+
+struct block {
+    struct block *next;
+};
+
+// receive workers get blocks, main thread puts them back
+static pthread_spinlock_t lock;
+
+static struct block *freelist = NULL;
+static int hugetlb = 0;
+static long reserved = 0;
+static long allocs = 0;
+static long blocks = 0;
+static long nfree = 0;
+
+
+void pool_init(int hugepages)
+{
+    pthread_spin_init(&lock, PTHREAD_PROCESS_PRIVATE);
+    hugetlb = hugepages;
+}
+
+
+/*
+ * Allocate one more slab and put its blocks to the free list
+ */
+static int pool_grow(void)
+{
+    char *slab = MAP_FAILED;
+    long i;
+
+    if (hugetlb) {
+        slab = mmap(NULL, SLAB_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        if (slab == MAP_FAILED) {
+            logger(LOG_INF, "<pool> huge pages unavailable: %s", strerror(errno));
+            hugetlb = 0;
+        }
+    }
+
+    if (slab == MAP_FAILED) {
+        slab = mmap(NULL, SLAB_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (slab == MAP_FAILED) {
+            logger(LOG_ERR, "<pool> mmap failed: %s", strerror(errno));
+            return -1;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(slab, SLAB_SIZE, MADV_HUGEPAGE);
+#endif
+    }
+
+    for (i = SLAB_BLOCKS - 1; i >= 0; i--) {
+        struct block *b = (void *) (slab + i * POOL_BLOCK_SIZE);
+        b->next = freelist;
+        freelist = b;
+    }
+
+    allocs++;
+    blocks += SLAB_BLOCKS;
+    nfree += SLAB_BLOCKS;
+
+    logger(LOG_DBG, "<pool> %ld blocks allocated", blocks);
+
+    return 0;
+}
+
+
+/*
+ * Make sure the pool can serve additional blocks without allocation
+ */
+int pool_reserve(long count)
+{
+    int rc = 0;
+
+    pthread_spin_lock(&lock);
+
+    reserved += count;
+
+    while (blocks < reserved + POOL_SPARE)
+        if ((rc = pool_grow()) < 0)
+            break;
+
+    pthread_spin_unlock(&lock);
+
+    return rc;
+}
+
+
+void pool_release(long count)
+{
+    pthread_spin_lock(&lock);
+    reserved -= count;
+    pthread_spin_unlock(&lock);
+}
+
+
+char *pool_get(void)
+{
+    struct block *b = NULL;
+
+    pthread_spin_lock(&lock);
+
+    if (freelist || pool_grow() == 0) {
+        b = freelist;
+        freelist = b->next;
+        nfree--;
+    }
+
+    pthread_spin_unlock(&lock);
+
+    return (char *) b;
+}
+
+
+void pool_put(char *ptr)
+{
+    struct block *b;
+
+    b = (void *) ((uintptr_t) ptr & ~(uintptr_t) (POOL_BLOCK_SIZE - 1));
+
+    pthread_spin_lock(&lock);
+    b->next = freelist;
+    freelist = b;
+    nfree++;
+    pthread_spin_unlock(&lock);
+}
+
+
+void pool_stats(struct pool_stats *stats)
+{
+    pthread_spin_lock(&lock);
+    stats->allocs = allocs;
+    stats->blocks = blocks;
+    stats->free = nfree;
+    pthread_spin_unlock(&lock);
+}
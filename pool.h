@@ -0,0 +1,48 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#ifndef _POOL_H
+#define _POOL_H 1
+
+/*
+ * Packet buffer pool
+ *
+ * Fixed size blocks carved from mmap()ed slabs. Blocks are aligned to
+ * their size, so any pointer inside a block can be returned to the pool.
+ */
+
+#define POOL_BLOCK_SIZE 2048
+
+struct pool_stats {
+    long allocs;               // slab allocations
+    long blocks;               // total blocks
+    long free;                 // free blocks
+};
+
+void pool_init(int hugepages);
+int pool_reserve(long blocks);
+void pool_release(long blocks);
+char *pool_get(void);
+void pool_put(char *ptr);
+void pool_stats(struct pool_stats *stats);
+
+#endif
@@ -0,0 +1,279 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESAMPLE_X86 1
+#endif
+
+#include "resample.h"
+#include "logger.h"
+
+#define RESAMPLE_CUTOFF 0.92     // passband edge, fraction of nyquist
+#define RESAMPLE_BETA 8.0        // kaiser window shape
+
+struct resampler {
+    long channels;
+    float *rows;                 // planar input history, one row per channel
+    long have;                   // frames in rows
+    double pos;                  // next output frame position in rows
+};
+
+struct kernels {
+    const char *name;
+    // dot product of RESAMPLE_TAPS frames with phase interpolated taps
+    float (*fir)(const float *x, const float *h0, const float *h1, float t);
+};
+
+// phases 0..RESAMPLE_PHASES, the last one is the next frame's phase 0
+static float coef[RESAMPLE_PHASES + 1][RESAMPLE_TAPS] __attribute__((aligned(32)));
+static struct kernels *kernels;
+
+
+static float fir_scalar(const float *x, const float *h0, const float *h1, float t)
+{
+    float sum = 0;
+    int i;
+
+    for (i = 0; i < RESAMPLE_TAPS; i++)
+        sum += x[i] * (h0[i] + t * (h1[i] - h0[i]));
+
+    return sum;
+}
+
+
+static struct kernels scalar = { "scalar", fir_scalar };
+
+
+#ifdef RESAMPLE_X86
+
+__attribute__((target("sse2")))
+static float fir_sse2(const float *x, const float *h0, const float *h1, float t)
+{
+    __m128 tt = _mm_set1_ps(t), acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    float sum[4];
+    int i;
+
+    for (i = 0; i < RESAMPLE_TAPS; i += 8) {
+        __m128 a = _mm_load_ps(h0 + i), b = _mm_load_ps(h0 + i + 4);
+        __m128 ha = _mm_add_ps(a, _mm_mul_ps(tt, _mm_sub_ps(_mm_load_ps(h1 + i), a)));
+        __m128 hb = _mm_add_ps(b, _mm_mul_ps(tt, _mm_sub_ps(_mm_load_ps(h1 + i + 4), b)));
+
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + i), ha));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + i + 4), hb));
+    }
+
+    _mm_storeu_ps(sum, _mm_add_ps(acc0, acc1));
+
+    return (sum[0] + sum[2]) + (sum[1] + sum[3]);
+}
+
+
+static struct kernels sse2 = { "sse2", fir_sse2 };
+
+
+__attribute__((target("avx2,fma")))
+static float fir_avx2(const float *x, const float *h0, const float *h1, float t)
+{
+    __m256 tt = _mm256_set1_ps(t), acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m128 s;
+    int i;
+
+    for (i = 0; i < RESAMPLE_TAPS; i += 16) {
+        __m256 a = _mm256_load_ps(h0 + i), b = _mm256_load_ps(h0 + i + 8);
+        __m256 ha = _mm256_fmadd_ps(tt, _mm256_sub_ps(_mm256_load_ps(h1 + i), a), a);
+        __m256 hb = _mm256_fmadd_ps(tt, _mm256_sub_ps(_mm256_load_ps(h1 + i + 8), b), b);
+
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), ha, acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), hb, acc1);
+    }
+
+    acc0 = _mm256_add_ps(acc0, acc1);
+    s = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+
+    return _mm_cvtss_f32(s);
+}
+
+
+static struct kernels avx2 = { "avx2", fir_avx2 };
+
+#endif
+
+
+/*
+ * Zeroth order modified bessel function, kaiser window
+ */
+static double bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+    int k;
+
+    for (k = 1; k < 32; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+
+/*
+ * Fill filter table and pick kernels for this cpu
+ */
+int resample_init(void)
+{
+    long p, k;
+
+    for (p = 0; p <= RESAMPLE_PHASES; p++) {
+        double sum = 0;
+
+        for (k = 0; k < RESAMPLE_TAPS; k++) {
+            // distance from tap to output position
+            double d = k - (RESAMPLE_TAPS / 2 - 1) - (double) p / RESAMPLE_PHASES;
+            double x = d / (RESAMPLE_TAPS / 2), w = 0, s = 1;
+
+            if (fabs(x) < 1)
+                w = bessel_i0(RESAMPLE_BETA * sqrt(1 - x * x)) / bessel_i0(RESAMPLE_BETA);
+
+            if (d != 0)
+                s = sin(M_PI * RESAMPLE_CUTOFF * d) / (M_PI * RESAMPLE_CUTOFF * d);
+
+            coef[p][k] = s * w;
+            sum += s * w;
+        }
+
+        // unity gain at dc for every phase
+        for (k = 0; k < RESAMPLE_TAPS; k++)
+            coef[p][k] /= sum;
+    }
+
+    kernels = &scalar;
+
+#ifdef RESAMPLE_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        kernels = &avx2;
+    else
+    if (__builtin_cpu_supports("sse2"))
+        kernels = &sse2;
+#endif
+
+    logger(LOG_VRB, "resampler: %s, %d taps", kernels->name, RESAMPLE_TAPS);
+
+    return 0;
+}
+
+
+struct resampler *resampler_create(long channels)
+{
+    struct resampler *r = calloc(1, sizeof(struct resampler));
+
+    if (!r)
+        return NULL;
+
+    r->channels = channels;
+    r->rows = calloc(channels * (RESAMPLE_TAPS + RESAMPLE_BLOCK), sizeof(float));
+    if (!r->rows) {
+        free(r);
+        return NULL;
+    }
+
+    // silent history, first output frame is the first input frame
+    r->have = RESAMPLE_TAPS / 2 - 1;
+    r->pos = RESAMPLE_TAPS / 2 - 1;
+
+    return r;
+}
+
+
+void resampler_free(struct resampler *r)
+{
+    if (!r)
+        return;
+
+    free(r->rows);
+    free(r);
+}
+
+
+/*
+ * Resample interleaved frames, ratio is output frames per input frame.
+ * Returns frames stored to dst, up to max
+ */
+long resample(struct resampler *r, float *dst, long max, const float *src, long frames,
+              double ratio)
+{
+    long row = RESAMPLE_TAPS + RESAMPLE_BLOCK, step, out = 0, i, c;
+    double inc = 1.0 / ratio;
+
+    for (; frames > 0; frames -= step, src += step * r->channels) {
+        long keep;
+
+        step = frames < RESAMPLE_BLOCK ? frames : RESAMPLE_BLOCK;
+
+        // append to history rows
+        for (i = 0; i < step; i++)
+            for (c = 0; c < r->channels; c++)
+                r->rows[c * row + r->have + i] = src[i * r->channels + c];
+
+        r->have += step;
+
+        // every output frame needs half of the taps ahead of it
+        while ((long) r->pos + RESAMPLE_TAPS / 2 < r->have && out < max) {
+            long idx = (long) r->pos;
+            float ph = (float) ((r->pos - idx) * RESAMPLE_PHASES);
+            int p = (int) ph;
+            const float *x = r->rows + idx - (RESAMPLE_TAPS / 2 - 1);
+
+            for (c = 0; c < r->channels; c++, x += row)
+                *(dst++) = kernels->fir(x, coef[p], coef[p + 1], ph - p);
+
+            r->pos += inc;
+            out++;
+        }
+
+        // drop frames no longer under the filter, skip input if dst is full
+        keep = (long) r->pos - (RESAMPLE_TAPS / 2 - 1);
+        if (keep < r->have - RESAMPLE_TAPS)
+            keep = r->have - RESAMPLE_TAPS;
+        if (keep > r->have)
+            keep = r->have;
+
+        for (c = 0; c < r->channels; c++)
+            memmove(r->rows + c * row, r->rows + c * row + keep,
+                    (r->have - keep) * sizeof(float));
+
+        r->have -= keep;
+        r->pos -= keep;
+        if (r->pos < RESAMPLE_TAPS / 2 - 1)
+            r->pos = RESAMPLE_TAPS / 2 - 1;
+    }
+
+    return out;
+}
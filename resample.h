@@ -0,0 +1,43 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#ifndef _RESAMPLE_H
+#define _RESAMPLE_H 1
+
+/*
+ * Fractional resampler for small rate corrections: windowed sinc,
+ * polyphase table with linear interpolation between phases
+ */
+
+#define RESAMPLE_TAPS 32         // filter length, multiple of 8
+#define RESAMPLE_PHASES 256      // table phases per input frame
+#define RESAMPLE_BLOCK 1024      // input frames per pass
+
+struct resampler;
+
+int resample_init(void);
+struct resampler *resampler_create(long channels);
+void resampler_free(struct resampler *r);
+long resample(struct resampler *r, float *dst, long max, const float *src, long frames,
+              double ratio);
+
+#endif
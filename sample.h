@@ -0,0 +1,137 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#ifndef _SAMPLE_H
+#define _SAMPLE_H 1
+
+#include <stdint.h>
+#include <string.h>
+#include "vban.h"
+
+/*
+ * Single sample access, little endian, full scale is [-1.0, 1.0)
+ */
+
+static inline long sample_size(long format)
+{
+    switch (format) {
+        case VBAN_DATATYPE_BYTE8:
+            return 1;
+        case VBAN_DATATYPE_INT16:
+            return 2;
+        case VBAN_DATATYPE_INT24:
+            return 3;
+        case VBAN_DATATYPE_INT32:
+            return 4;
+        case VBAN_DATATYPE_FLOAT32:
+            return 4;
+        case VBAN_DATATYPE_FLOAT64:
+            return 8;
+    }
+
+    // unsupported
+    return 0;
+}
+
+
+static inline double sample_get(const char *p, long format)
+{
+    const unsigned char *u = (const void *) p;
+    int16_t s16;
+    int32_t s32;
+    float f32;
+    double f64;
+
+    switch (format) {
+        case VBAN_DATATYPE_BYTE8:
+            return (u[0] - 128) / 128.0;
+        case VBAN_DATATYPE_INT16:
+            memcpy(&s16, p, 2);
+            return s16 / 32768.0;
+        case VBAN_DATATYPE_INT24:
+            s32 = (int32_t) ((uint32_t) u[0] << 8 | (uint32_t) u[1] << 16 | (uint32_t) u[2] << 24);
+            return (s32 >> 8) / 8388608.0;
+        case VBAN_DATATYPE_INT32:
+            memcpy(&s32, p, 4);
+            return s32 / 2147483648.0;
+        case VBAN_DATATYPE_FLOAT32:
+            memcpy(&f32, p, 4);
+            return f32;
+        case VBAN_DATATYPE_FLOAT64:
+            memcpy(&f64, p, 8);
+            return f64;
+    }
+
+    return 0.0;
+}
+
+
+static inline int32_t sample_clamp(double v, double scale)
+{
+    v = v * scale + (v < 0 ? -0.5 : 0.5);
+
+    if (v >= scale - 1.0)
+        return (int32_t) (scale - 1.0);
+
+    if (v <= -scale)
+        return (int32_t) -scale;
+
+    return (int32_t) v;
+}
+
+
+static inline void sample_put(char *p, long format, double v)
+{
+    unsigned char *u = (void *) p;
+    int16_t s16;
+    int32_t s32;
+    float f32;
+
+    switch (format) {
+        case VBAN_DATATYPE_BYTE8:
+            u[0] = (unsigned char) (sample_clamp(v, 128.0) + 128);
+            break;
+        case VBAN_DATATYPE_INT16:
+            s16 = (int16_t) sample_clamp(v, 32768.0);
+            memcpy(p, &s16, 2);
+            break;
+        case VBAN_DATATYPE_INT24:
+            s32 = sample_clamp(v, 8388608.0);
+            u[0] = s32 & 0xff;
+            u[1] = (s32 >> 8) & 0xff;
+            u[2] = (s32 >> 16) & 0xff;
+            break;
+        case VBAN_DATATYPE_INT32:
+            s32 = sample_clamp(v, 2147483648.0);
+            memcpy(p, &s32, 4);
+            break;
+        case VBAN_DATATYPE_FLOAT32:
+            f32 = (float) v;
+            memcpy(p, &f32, 4);
+            break;
+        case VBAN_DATATYPE_FLOAT64:
+            memcpy(p, &v, 8);
+            break;
+    }
+}
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fnmatch.h>
+
+#include "session.h"
+#include "logger.h"
+
+// routing table, first matching pattern wins
+struct session *sessions = NULL;
+static struct session *tail = NULL;
+
+// names no session takes, direct mapped: routing table never changes
+// once receiving, so unrouted senders cost a lookup, not pattern matching
+#define UNROUTED_SLOTS 256
+static char unrouted[UNROUTED_SLOTS][SESSION_NAME_MAX];
+
+
+/*
+ * Session for the pattern, added to the end of routing table if new
+ */
+struct session *session_add(const char *pattern)
+{
+    struct session *session;
+
+    for (session = sessions; session; session = session->next)
+        if (!strcmp(session->pattern, pattern))
+            return session;
+
+    if (strlen(pattern) >= SESSION_PATTERN_MAX) {
+        logger(LOG_ERR, "too long stream name pattern: %s", pattern);
+        return NULL;
+    }
+
+    session = calloc(1, sizeof(struct session));
+    if (!session) {
+        logger(LOG_ERR, "cannot allocate memory!");
+        return NULL;
+    }
+
+    session->output = output_create();
+    if (!session->output) {
+        logger(LOG_ERR, "cannot allocate memory!");
+        free(session);
+        return NULL;
+    }
+
+    strcpy(session->pattern, pattern);
+
+    if (sessions)
+        tail->next = session;
+    else
+        sessions = session;
+
+    tail = session;
+
+    return session;
+}
+
+
+/*
+ * Add output pipe to the session
+ */
+int session_pipe(struct session *session, const char *pipename)
+{
+    if (session->npipes >= WRITER_TARGETS_MAX) {
+        logger(LOG_ERR, "too many pipes: %s", pipename);
+        return -1;
+    }
+
+    session->pipenames[session->npipes] = strdup(pipename);
+    if (!session->pipenames[session->npipes]) {
+        logger(LOG_ERR, "cannot allocate memory!");
+        return -1;
+    }
+
+    session->npipes++;
+
+    return 0;
+}
+
+
+/*
+ * Route stream by name, NULL if no session takes it
+ */
+struct session *session_route(const char *name)
+{
+    struct session *session;
+    const unsigned char *p;
+    uint32_t hash = 2166136261u;
+    char *slot;
+
+    for (p = (const void *) name; *p; p++)
+        hash = (hash ^ *p) * 16777619u;
+
+    slot = unrouted[hash & (UNROUTED_SLOTS - 1)];
+    if (slot[0] && !strcmp(slot, name))
+        return NULL;
+
+    for (session = sessions; session; session = session->next)
+        if (!fnmatch(session->pattern, name, 0))
+            return session;
+
+    // remember and report it once
+    logger(LOG_INF, "[%s] no session for stream, ignoring", name);
+
+    strncpy(slot, name, SESSION_NAME_MAX - 1);
+
+    return NULL;
+}
@@ -0,0 +1,57 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#ifndef _SESSION_H
+#define _SESSION_H 1
+
+#include "streams.h"
+#include "output.h"
+#include "writer.h"
+
+/*
+ * Sessions: streams routed by name to independent outputs, each with
+ * its own primary and backups
+ */
+
+#define SESSION_PATTERN_MAX 64
+#define SESSION_NAME_MAX 20        // stream name, as in VBAN header
+
+struct session {
+    char pattern[SESSION_PATTERN_MAX]; // stream names, fnmatch(3) pattern
+    char *pipenames[WRITER_TARGETS_MAX];
+    int npipes;
+
+    struct stream *streams;    // primary first, then backups
+    struct stream *tail;       // tail of streams list
+    struct output *output;
+    time_t promoted;           // last primary switch, seconds
+
+    struct session *next;
+};
+
+extern struct session *sessions;
+
+struct session *session_add(const char *pattern);
+int session_pipe(struct session *session, const char *pipename);
+struct session *session_route(const char *name);
+
+#endif
@@ -0,0 +1,401 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SILENCE_X86 1
+#endif
+
+#include "silence.h"
+#include "logger.h"
+#include "vban.h"
+
+// samples are silent if their amplitude does not exceed threshold
+static struct {
+    int32_t u8;                // distance from 128
+    int32_t s16;
+    int32_t s24;
+    int32_t s32;
+    float f32;
+    double f64;
+} threshold;
+
+struct kernels {
+    const char *name;
+    int (*u8)(const uint8_t *, long);
+    int (*s16)(const int16_t *, long);
+    int (*s32)(const int32_t *, long);
+    int (*f32)(const float *, long);
+    int (*f64)(const double *, long);
+};
+
+static struct kernels *kernels;
+
+
+/*
+ * Scalar kernels, also handle tails of vector kernels
+ */
+static int u8_scalar(const uint8_t *s, long n)
+{
+    long i;
+
+    for (i = 0; i < n; i++)
+        if (abs((int32_t) s[i] - 128) > threshold.u8)
+            return 0;
+
+    return 1;
+}
+
+
+static int s16_scalar(const int16_t *s, long n)
+{
+    long i;
+
+    for (i = 0; i < n; i++)
+        if (abs((int32_t) s[i]) > threshold.s16)
+            return 0;
+
+    return 1;
+}
+
+
+static int s24_scalar(const uint8_t *s, long n)
+{
+    long i;
+
+    for (i = 0; i < n; i++, s += 3) {
+        // sign extend little endian 24 bit sample
+        int32_t v = (int32_t) ((uint32_t) s[0] << 8 | (uint32_t) s[1] << 16 |
+                               (uint32_t) s[2] << 24) >> 8;
+        if (abs(v) > threshold.s24)
+            return 0;
+    }
+
+    return 1;
+}
+
+
+static int s32_scalar(const int32_t *s, long n)
+{
+    long i;
+
+    // -2^31 has no absolute value
+    for (i = 0; i < n; i++)
+        if (s[i] > threshold.s32 || s[i] < -threshold.s32)
+            return 0;
+
+    return 1;
+}
+
+
+static int f32_scalar(const float *s, long n)
+{
+    long i;
+
+    for (i = 0; i < n; i++)
+        if (!(fabsf(s[i]) <= threshold.f32))
+            return 0;
+
+    return 1;
+}
+
+
+static int f64_scalar(const double *s, long n)
+{
+    long i;
+
+    for (i = 0; i < n; i++)
+        if (!(fabs(s[i]) <= threshold.f64))
+            return 0;
+
+    return 1;
+}
+
+
+static struct kernels scalar = {
+    "scalar", u8_scalar, s16_scalar, s32_scalar, f32_scalar, f64_scalar
+};
+
+
+#ifdef SILENCE_X86
+
+/*
+ * SSE2 kernels: accumulate out of range lanes, check once per call
+ */
+__attribute__((target("sse2")))
+static int u8_sse2(const uint8_t *s, long n)
+{
+    __m128i sign = _mm_set1_epi8((char) 0x80);
+    __m128i hi = _mm_set1_epi8((char) threshold.u8);
+    __m128i lo = _mm_set1_epi8((char) -threshold.u8);
+    __m128i acc = _mm_setzero_si128();
+    long i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        // unsigned to signed around 128
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((const void *) (s + i)), sign);
+        acc = _mm_or_si128(acc, _mm_or_si128(_mm_cmpgt_epi8(v, hi), _mm_cmpgt_epi8(lo, v)));
+    }
+
+    return !_mm_movemask_epi8(acc) && u8_scalar(s + i, n - i);
+}
+
+
+__attribute__((target("sse2")))
+static int s16_sse2(const int16_t *s, long n)
+{
+    __m128i hi = _mm_set1_epi16((short) threshold.s16);
+    __m128i lo = _mm_set1_epi16((short) -threshold.s16);
+    __m128i acc = _mm_setzero_si128();
+    long i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const void *) (s + i));
+        acc = _mm_or_si128(acc, _mm_or_si128(_mm_cmpgt_epi16(v, hi), _mm_cmpgt_epi16(lo, v)));
+    }
+
+    return !_mm_movemask_epi8(acc) && s16_scalar(s + i, n - i);
+}
+
+
+__attribute__((target("sse2")))
+static int s32_sse2(const int32_t *s, long n)
+{
+    __m128i hi = _mm_set1_epi32(threshold.s32);
+    __m128i lo = _mm_set1_epi32(-threshold.s32);
+    __m128i acc = _mm_setzero_si128();
+    long i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const void *) (s + i));
+        acc = _mm_or_si128(acc, _mm_or_si128(_mm_cmpgt_epi32(v, hi), _mm_cmpgt_epi32(lo, v)));
+    }
+
+    return !_mm_movemask_epi8(acc) && s32_scalar(s + i, n - i);
+}
+
+
+__attribute__((target("sse2")))
+static int f32_sse2(const float *s, long n)
+{
+    __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 t = _mm_set1_ps(threshold.f32);
+    __m128 acc = _mm_setzero_ps();
+    long i;
+
+    // NaN is never silent
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128 v = _mm_and_ps(_mm_loadu_ps(s + i), mask);
+        acc = _mm_or_ps(acc, _mm_cmpnle_ps(v, t));
+    }
+
+    return !_mm_movemask_ps(acc) && f32_scalar(s + i, n - i);
+}
+
+
+__attribute__((target("sse2")))
+static int f64_sse2(const double *s, long n)
+{
+    __m128d mask = _mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffffLL));
+    __m128d t = _mm_set1_pd(threshold.f64);
+    __m128d acc = _mm_setzero_pd();
+    long i;
+
+    for (i = 0; i + 2 <= n; i += 2) {
+        __m128d v = _mm_and_pd(_mm_loadu_pd(s + i), mask);
+        acc = _mm_or_pd(acc, _mm_cmpnle_pd(v, t));
+    }
+
+    return !_mm_movemask_pd(acc) && f64_scalar(s + i, n - i);
+}
+
+
+static struct kernels sse2 = {
+    "sse2", u8_sse2, s16_sse2, s32_sse2, f32_sse2, f64_sse2
+};
+
+
+/*
+ * AVX2 kernels
+ */
+__attribute__((target("avx2")))
+static int u8_avx2(const uint8_t *s, long n)
+{
+    __m256i sign = _mm256_set1_epi8((char) 0x80);
+    __m256i hi = _mm256_set1_epi8((char) threshold.u8);
+    __m256i lo = _mm256_set1_epi8((char) -threshold.u8);
+    __m256i acc = _mm256_setzero_si256();
+    long i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const void *) (s + i)), sign);
+        acc = _mm256_or_si256(acc, _mm256_or_si256(_mm256_cmpgt_epi8(v, hi),
+                                                   _mm256_cmpgt_epi8(lo, v)));
+    }
+
+    return _mm256_testz_si256(acc, acc) && u8_scalar(s + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+static int s16_avx2(const int16_t *s, long n)
+{
+    __m256i hi = _mm256_set1_epi16((short) threshold.s16);
+    __m256i lo = _mm256_set1_epi16((short) -threshold.s16);
+    __m256i acc = _mm256_setzero_si256();
+    long i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256((const void *) (s + i));
+        acc = _mm256_or_si256(acc, _mm256_or_si256(_mm256_cmpgt_epi16(v, hi),
+                                                   _mm256_cmpgt_epi16(lo, v)));
+    }
+
+    return _mm256_testz_si256(acc, acc) && s16_scalar(s + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+static int s32_avx2(const int32_t *s, long n)
+{
+    __m256i hi = _mm256_set1_epi32(threshold.s32);
+    __m256i lo = _mm256_set1_epi32(-threshold.s32);
+    __m256i acc = _mm256_setzero_si256();
+    long i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const void *) (s + i));
+        acc = _mm256_or_si256(acc, _mm256_or_si256(_mm256_cmpgt_epi32(v, hi),
+                                                   _mm256_cmpgt_epi32(lo, v)));
+    }
+
+    return _mm256_testz_si256(acc, acc) && s32_scalar(s + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+static int f32_avx2(const float *s, long n)
+{
+    __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 t = _mm256_set1_ps(threshold.f32);
+    __m256 acc = _mm256_setzero_ps();
+    long i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_and_ps(_mm256_loadu_ps(s + i), mask);
+        acc = _mm256_or_ps(acc, _mm256_cmp_ps(v, t, _CMP_NLE_UQ));
+    }
+
+    return !_mm256_movemask_ps(acc) && f32_scalar(s + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+static int f64_avx2(const double *s, long n)
+{
+    __m256d mask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+    __m256d t = _mm256_set1_pd(threshold.f64);
+    __m256d acc = _mm256_setzero_pd();
+    long i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256d v = _mm256_and_pd(_mm256_loadu_pd(s + i), mask);
+        acc = _mm256_or_pd(acc, _mm256_cmp_pd(v, t, _CMP_NLE_UQ));
+    }
+
+    return !_mm256_movemask_pd(acc) && f64_scalar(s + i, n - i);
+}
+
+
+static struct kernels avx2 = {
+    "avx2", u8_avx2, s16_avx2, s32_avx2, f32_avx2, f64_avx2
+};
+
+#endif
+
+
+/*
+ * Set silence threshold in dBFS and pick kernels for this cpu,
+ * threshold below -200 dBFS means digital silence only
+ */
+int silence_init(double dbfs)
+{
+    double level = dbfs < -200.0 ? 0.0 : pow(10.0, dbfs / 20.0);
+
+    if (level > 1.0) {
+        logger(LOG_ERR, "bad silence threshold: %.1f dBFS", dbfs);
+        return -1;
+    }
+
+    threshold.u8 = (int32_t) floor(level * 127.0);
+    threshold.s16 = (int32_t) floor(level * 32767.0);
+    threshold.s24 = (int32_t) floor(level * 8388607.0);
+    threshold.s32 = (int32_t) floor(level * 2147483647.0);
+    threshold.f32 = (float) level;
+    threshold.f64 = level;
+
+    kernels = &scalar;
+
+#ifdef SILENCE_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        kernels = &avx2;
+    else
+    if (__builtin_cpu_supports("sse2"))
+        kernels = &sse2;
+#endif
+
+    logger(LOG_VRB, "silence detection: %s, threshold %.1f dBFS", kernels->name, dbfs);
+
+    return 0;
+}
+
+
+/*
+ * Check if all samples are silent
+ */
+int silence_detect(const void *data, long samples, long format)
+{
+    switch (format) {
+        case VBAN_DATATYPE_BYTE8:
+            return kernels->u8(data, samples);
+        case VBAN_DATATYPE_INT16:
+            return kernels->s16(data, samples);
+        case VBAN_DATATYPE_INT24:
+            return s24_scalar(data, samples);
+        case VBAN_DATATYPE_INT32:
+            return kernels->s32(data, samples);
+        case VBAN_DATATYPE_FLOAT32:
+            return kernels->f32(data, samples);
+        case VBAN_DATATYPE_FLOAT64:
+            return kernels->f64(data, samples);
+    }
+
+    // unknown formats are never silent
+    return 0;
+}
@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <math.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -34,35 +35,412 @@
 #include "vban.h"
 #include "logger.h"
 #include "streams.h"
+#include "input.h"
+#include "pool.h"
+#include "sync.h"
+#include "xcorr.h"
+#include "drift.h"
+#include "session.h"
 
-#define DATA_BUFFER_SIZE 1436
+// streams hash table, open addressing with linear probing
+static struct stream **table = NULL;
+static size_t table_size = 0;
+static size_t table_used = 0;
 
-struct stream *streams = NULL;
+// last found stream, packets usually come back to back
+static struct stream *last = NULL;
+
+// health: loss EWMA weight per update, jitter weight
+#define HEALTH_ALPHA 0.25
+#define HEALTH_JITTER 0.1
+
+// streams expiration timer wheel, slots cover 2 seconds
+#define WHEEL_SLOTS 256
+#define WHEEL_TICK_MSEC 8
+
+static struct stream *wheel[WHEEL_SLOTS];
+static int64_t wheel_tick = -1;       // current tick, -1 if wheel is empty
+static int64_t wheel_next = INT64_MAX; // earliest non-empty slot, msec
+
+// reorder window for new streams, packets
+static long window = STREAM_WINDOW_DEFAULT;
+
+
+static int64_t tsmsec(struct timespec *ts)
+{
+    return (int64_t) ts->tv_sec * 1000 + ts->tv_nsec / 1000000;
+}
 
 
 /*
- * Cleanup streams
+ * Schedule stream expiration check
  */
-void forgetstreams(void)
+static void wheeladd(struct stream *stream)
 {
-    struct stream *stream = streams;
+    int64_t tick = stream->expires / WHEEL_TICK_MSEC;
+    struct stream **slot;
+
+    if (wheel_tick < 0)
+        wheel_tick = tsmsec(&stream->ts_last) / WHEEL_TICK_MSEC;
 
-    while (stream) {
-        struct stream *del = stream;
-        stream = stream->next;
+    // current slot is being processed, never go back
+    if (tick <= wheel_tick)
+        tick = wheel_tick + 1;
 
-        logger(LOG_INF, "[%s@%s] stream offline", del->name, del->ifname);
+    // far expirations are checked early and rescheduled
+    if (tick >= wheel_tick + WHEEL_SLOTS)
+        tick = wheel_tick + WHEEL_SLOTS - 1;
 
-        if (del->curr.data)
-            free(del->curr.data);
+    slot = &wheel[tick & (WHEEL_SLOTS - 1)];
 
-        if (del->prev.data)
-            free(del->prev.data);
+    stream->wheel_next = *slot;
+    stream->wheel_pprev = slot;
+    if (*slot)
+        (*slot)->wheel_pprev = &stream->wheel_next;
+    *slot = stream;
+
+    if (tick * WHEEL_TICK_MSEC < wheel_next)
+        wheel_next = tick * WHEEL_TICK_MSEC;
+}
+
+
+static void wheelremove(struct stream *stream)
+{
+    if (!stream->wheel_pprev)
+        return;
+
+    *stream->wheel_pprev = stream->wheel_next;
+    if (stream->wheel_next)
+        stream->wheel_next->wheel_pprev = stream->wheel_pprev;
+
+    stream->wheel_next = NULL;
+    stream->wheel_pprev = NULL;
+}
 
-        free(del);
+
+/*
+ * Hash stream key: interface, peer address and port, stream name
+ */
+static uint32_t streamhash(const char *name, struct sockaddr *addr, unsigned ifindex)
+{
+    const unsigned char *p;
+    uint32_t hash = 2166136261u;
+    size_t i, len;
+
+    switch (addr->sa_family) {
+        case AF_INET: {
+            struct sockaddr_in *in = (void *) addr;
+            hash = (hash ^ in->sin_port) * 16777619u;
+            p = (const void *) &in->sin_addr.s_addr;
+            len = sizeof(in->sin_addr.s_addr);
+            break;
+        }
+#ifdef AF_INET6
+        case AF_INET6: {
+            struct sockaddr_in6 *in6 = (void *) addr;
+            hash = (hash ^ in6->sin6_port) * 16777619u;
+            hash = (hash ^ in6->sin6_scope_id) * 16777619u;
+            p = in6->sin6_addr.s6_addr;
+            len = sizeof(in6->sin6_addr.s6_addr);
+            break;
+        }
+#endif
+        default:
+            p = NULL;
+            len = 0;
     }
 
-    streams = NULL;
+    hash = (hash ^ ifindex) * 16777619u;
+
+    for (i = 0; i < len; i++)
+        hash = (hash ^ p[i]) * 16777619u;
+
+    for (; *name; name++)
+        hash = (hash ^ (unsigned char) *name) * 16777619u;
+
+    return hash;
+}
+
+
+/*
+ * Check if the packet belongs to the stream
+ */
+static int streammatch(struct stream *stream, const char *name,
+                       struct sockaddr *addr, unsigned ifindex)
+{
+    struct sockaddr *peer = (void *) &stream->peer;
+
+    // check interface
+    if (stream->ifindex != ifindex)
+        return 0;
+
+    // check peer address family
+    if (peer->sa_family != addr->sa_family)
+        return 0;
+
+    // check peer address
+    switch (peer->sa_family) {
+        case AF_INET: {
+            struct sockaddr_in *in1 = (void *) addr, *in2 = (void *) peer;
+            if (in1->sin_port != in2->sin_port)
+                return 0;
+            if (in1->sin_addr.s_addr != in2->sin_addr.s_addr)
+                return 0;
+            break;
+        }
+#ifdef AF_INET6
+        case AF_INET6: {
+            struct sockaddr_in6 *in1 = (void *) addr, *in2 = (void *) peer;
+            if (in1->sin6_port != in2->sin6_port)
+                return 0;
+            if (in1->sin6_flowinfo != in2->sin6_flowinfo)
+                return 0;
+            if (in1->sin6_scope_id != in2->sin6_scope_id)
+                return 0;
+            if (memcmp(in1->sin6_addr.s6_addr,
+                       in2->sin6_addr.s6_addr,
+                       sizeof(in1->sin6_addr.s6_addr)))
+                return 0;
+            break;
+        }
+#endif
+        default:
+            return 0;
+    }
+
+    // check stream name
+    return !strcmp(name, stream->name);
+}
+
+
+/*
+ * Insert stream into hash table
+ */
+static int tableinsert(struct stream *stream)
+{
+    size_t i;
+
+    // keep load factor below 1/2
+    if ((table_used + 1) * 2 > table_size) {
+        size_t size = table_size ? table_size * 2 : 64;
+        struct stream **newtable = calloc(size, sizeof(struct stream *));
+
+        if (!newtable)
+            return -1;
+
+        for (i = 0; i < table_size; i++) {
+            size_t j;
+
+            if (!table[i])
+                continue;
+
+            for (j = table[i]->hash & (size - 1); newtable[j]; j = (j + 1) & (size - 1));
+            newtable[j] = table[i];
+        }
+
+        free(table);
+        table = newtable;
+        table_size = size;
+    }
+
+    for (i = stream->hash & (table_size - 1); table[i]; i = (i + 1) & (table_size - 1));
+
+    table[i] = stream;
+    table_used++;
+
+    return 0;
+}
+
+
+/*
+ * Remove stream from hash table
+ */
+static void tableremove(struct stream *stream)
+{
+    size_t i, j, k;
+
+    for (i = stream->hash & (table_size - 1); table[i] != stream; i = (i + 1) & (table_size - 1));
+
+    // backward shift deletion, no tombstones
+    for (j = (i + 1) & (table_size - 1); table[j]; j = (j + 1) & (table_size - 1)) {
+        k = table[j]->hash & (table_size - 1);
+
+        // entry at j can be moved to the hole at i
+        // only if its home slot k is not in (i, j]
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+            table[i] = table[j];
+            i = j;
+        }
+    }
+
+    table[i] = NULL;
+    table_used--;
+}
+
+
+/*
+ * Return packets in reorder window and their reservation to the pool
+ */
+static void windowfree(struct stream *stream)
+{
+    long i;
+
+    for (i = 0; i < stream->window_size; i++)
+        if (stream->window[i].data)
+            pool_put(stream->window[i].data);
+
+    free(stream->window);
+    pool_release(stream->window_size);
+}
+
+
+/*
+ * Record window packets to sync history in packet order. Stops at a gap
+ * inside the window starting at packet first, the packet may still come.
+ */
+static void release(struct stream *stream, uint32_t first)
+{
+    while (stream->released != stream->expected) {
+        struct packet *packet = &stream->window[stream->released & (stream->window_size - 1)];
+
+        if (packet->data && packet->seq == stream->released) {
+            sync_record(stream, packet->seq, packet->data);
+            if (stream->xhist)
+                xcorr_record(stream, packet->seq, packet->data);
+        } else
+        if ((int32_t) (stream->released - first) >= 0)
+            break;
+
+        stream->released++;
+    }
+
+    // gaps before the window are lost for good
+    if ((int32_t) (first - stream->released) > 0)
+        stream->released = first;
+}
+
+
+/*
+ * Set reorder window for new streams, rounded up to a power of two
+ */
+void streamswindow(long packets)
+{
+    for (window = 1; window < packets; window <<= 1);
+}
+
+
+/*
+ * Size receive buffer for all known streams
+ */
+static void updatercvbuf(void)
+{
+    struct session *session;
+    struct stream *stream;
+    double pps = 0;
+
+    for (session = sessions; session; session = session->next)
+        for (stream = session->streams; stream; stream = stream->next)
+            pps += (double) stream->sample_rate / (double) stream->frames;
+
+    input_rcvbuf(pps);
+}
+
+
+/*
+ * Add new stream to the end of its session streams list
+ */
+int addstream(struct stream *stream)
+{
+    struct session *session = stream->session;
+
+    if (tableinsert(stream) < 0)
+        return -1;
+
+    stream->next = NULL;
+
+    if (session->streams)
+        session->tail->next = stream;
+    else
+        session->streams = stream;
+
+    session->tail = stream;
+
+    stream->expires = tsmsec(&stream->ts_last) + stream->timeout;
+    stream->wheel_pprev = NULL;
+    wheeladd(stream);
+
+    updatercvbuf();
+
+    return 0;
+}
+
+
+/*
+ * Move stream to the head of its session streams list
+ */
+void promotestream(struct stream *stream)
+{
+    struct session *session = stream->session;
+    struct stream *prev;
+
+    if (stream == session->streams)
+        return;
+
+    for (prev = session->streams; prev->next != stream; prev = prev->next);
+
+    prev->next = stream->next;
+    if (session->tail == stream)
+        session->tail = prev;
+
+    stream->next = session->streams;
+    session->streams = stream;
+}
+
+
+/*
+ * Update streams health once per second: loss ratio, jitter and
+ * timeout from inter-arrival statistics, average + k * stddev
+ */
+void streamshealth(struct session *session, double k)
+{
+    struct stream *stream;
+
+    for (stream = session->streams; stream; stream = stream->next) {
+        uint32_t packets = stream->expected - stream->expected_last;
+        long lost = stream->lost - stream->lost_last;
+        double ratio, stddev, msec;
+
+        ratio = packets ? (double) lost / (double) packets : 1.0;
+        if (ratio < 0.0)
+            ratio = 0.0;
+        if (ratio > 1.0)
+            ratio = 1.0;
+
+        stream->expected_last = stream->expected;
+        stream->lost_last = stream->lost;
+        stream->loss += (ratio - stream->loss) * HEALTH_ALPHA;
+
+        stddev = sqrt(stream->dt_variance);
+        stream->health = 1.0 - stream->loss - HEALTH_JITTER * stddev / stream->dt_average;
+
+        msec = (stream->dt_average + k * stddev) / 1000000.0;
+        if (msec < STREAM_TIMEOUT_MIN_MSEC)
+            msec = STREAM_TIMEOUT_MIN_MSEC;
+        if (msec > STREAM_TIMEOUT_MSEC)
+            msec = STREAM_TIMEOUT_MSEC;
+
+        stream->timeout = (long) msec;
+    }
+}
+
+
+/*
+ * Cleanup session streams
+ */
+void forgetstreams(struct session *session)
+{
+    while (session->streams)
+        forgetstream(session->streams);
 }
 
 
@@ -71,85 +449,125 @@ void forgetstreams(void)
  */
 void forgetstream(struct stream *stream)
 {
+    struct session *session = stream->session;
+
     logger(LOG_INF, "[%s@%s] stream offline", stream->name, stream->ifname);
 
-    if (stream == streams) {
-        streams = stream->next;
+    if (stream == session->streams) {
+        session->streams = stream->next;
+        if (session->tail == stream)
+            session->tail = NULL;
     } else {
         struct stream *prev;
-        for (prev = streams; prev->next != stream; prev = prev->next);
+        for (prev = session->streams; prev->next != stream; prev = prev->next);
         prev->next = stream->next;
+        if (session->tail == stream)
+            session->tail = prev;
     }
 
-    if (stream->curr.data)
-        free(stream->curr.data);
+    if (last == stream)
+        last = NULL;
 
-    if (stream->prev.data)
-        free(stream->prev.data);
+    wheelremove(stream);
+    windowfree(stream);
+    tableremove(stream);
 
+    if (!table_used) {
+        wheel_tick = -1;
+        wheel_next = INT64_MAX;
+    }
+
+    sync_done(stream);
+    xcorr_free(stream);
     free(stream);
+
+    updatercvbuf();
 }
 
 
 /*
- * Find stream for the packet
+ * Return next stream without packets for its timeout, NULL if none.
+ * Packets only update ts_last, the wheel checks each stream lazily
+ * once per timeout and reschedules the alive ones.
  */
-struct stream *getstream(struct vbaninfo *info, struct sockaddr *addr, unsigned ifindex)
+struct stream *expiredstream(struct timespec *now)
 {
+    int64_t msec = tsmsec(now);
+    int64_t tick = msec / WHEEL_TICK_MSEC;
     struct stream *stream;
+    int i;
 
-    if (!streams)
+    if (wheel_tick < 0)
         return NULL;
 
-    for (stream = streams; stream; stream = stream->next) {
-        struct sockaddr *peer = (void *) &stream->peer;
+    // every slot is visited at most once
+    if (tick - wheel_tick > WHEEL_SLOTS)
+        wheel_tick = tick - WHEEL_SLOTS;
 
-        // check interface
-        if (stream->ifindex != ifindex)
-            continue;
+    while (1) {
+        struct stream **slot = &wheel[wheel_tick & (WHEEL_SLOTS - 1)];
 
-        // check peer address family
-        if (peer->sa_family != addr->sa_family)
-            continue;
+        while ((stream = *slot)) {
+            wheelremove(stream);
 
-        // check peer address
-        switch (peer->sa_family) {
-            case AF_INET: {
-                struct sockaddr_in *in1 = (void *) addr, *in2 = (void *) peer;
-                if (in1->sin_port != in2->sin_port)
-                    continue;
-                if (in1->sin_addr.s_addr != in2->sin_addr.s_addr)
-                    continue;
-                break;
-            }
-#ifdef AF_INET6
-            case AF_INET6: {
-                struct sockaddr_in6 *in1 = (void *) addr, *in2 = (void *) peer;
-                if (in1->sin6_port != in2->sin6_port)
-                    continue;
-                if (in1->sin6_flowinfo != in2->sin6_flowinfo)
-                    continue;
-                if (in1->sin6_scope_id != in2->sin6_scope_id)
-                    continue;
-                if (memcmp(in1->sin6_addr.s6_addr,
-                           in2->sin6_addr.s6_addr,
-                           sizeof(in1->sin6_addr.s6_addr)))
-                    continue;
-                break;
-            }
-#endif
-            default:
-                continue;
+            stream->expires = tsmsec(&stream->ts_last) + stream->timeout;
+            if (stream->expires <= msec)
+                return stream;
+
+            wheeladd(stream);
         }
 
-        // check stream name
-        if (strcmp(info->stream_name, stream->name))
-            continue;
+        if (wheel_tick >= tick)
+            break;
 
-        // stream found
-        return stream;
+        wheel_tick++;
     }
 
+    // find next non-empty slot
+    wheel_next = INT64_MAX;
+    for (i = 1; i <= WHEEL_SLOTS; i++)
+        if (wheel[(wheel_tick + i) & (WHEEL_SLOTS - 1)]) {
+            wheel_next = (wheel_tick + i) * WHEEL_TICK_MSEC;
+            break;
+        }
+
+    return NULL;
+}
+
+
+/*
+ * Time of the next expiration check, msec, INT64_MAX if none
+ */
+int64_t nextexpiry(void)
+{
+    return wheel_next;
+}
+
+
+/*
+ * Find stream for the packet
+ */
+struct stream *getstream(struct vbaninfo *info, struct sockaddr *addr, unsigned ifindex)
+{
+    struct stream *stream;
+    uint32_t hash;
+    size_t i;
+
+    if (!table_used)
+        return NULL;
+
+    // fast path: same stream as the previous packet
+    if (last && streammatch(last, info->stream_name, addr, ifindex))
+        return last;
+
+    hash = streamhash(info->stream_name, addr, ifindex);
+
+    for (i = hash & (table_size - 1); (stream = table[i]); i = (i + 1) & (table_size - 1))
+        if (stream->hash == hash && streammatch(stream, info->stream_name, addr, ifindex)) {
+            last = stream;
+            return stream;
+        }
+
     return NULL;
 }
 
@@ -157,90 +575,32 @@ struct stream *getstream(struct vbaninfo *info, struct sockaddr *addr, unsigned
 /*
  * Receive and parse next VBAN packet
  */
-struct stream *recvvban(int sock)
+struct stream *recvvban(void)
 {
-    char *buffer;
-    char vban_header[VBAN_HEADER_SIZE];
-    uint8_t aux[1024];
     int64_t delta;
     int64_t delta1;
     int64_t delta2;
-    unsigned ifindex;
+    int64_t i;
+    uint32_t first;
+    struct packet *packet;
     struct stream *stream;
-    struct sockaddr_storage addr;
+    struct datagram dg;
     struct vbaninfo info;
-    struct iovec iov[2];
     struct timespec ts;
-    struct cmsghdr *cm;
-    struct msghdr m;
-    int found_idx;
-    int found_ts;
     ssize_t size;
 
-    buffer = malloc(DATA_BUFFER_SIZE);
-    if (!buffer) {
-        logger(LOG_ERR, "cannot allocate memory!");
-        return NULL;
-    }
-
     while (1) {
-        iov[0].iov_base = vban_header;
-        iov[0].iov_len = sizeof(vban_header);
-        iov[1].iov_base = buffer;
-        iov[1].iov_len = DATA_BUFFER_SIZE;
-
-        m.msg_name = &addr;
-        m.msg_namelen = sizeof(addr);
-        m.msg_iov = iov;
-        m.msg_iovlen = 2;
-        m.msg_control = aux;
-        m.msg_controllen = sizeof(aux);
-        m.msg_flags = 0;
-
-        size = recvmsg(sock, &m, 0);
-
-        if (size < 0 && errno == EINTR)
-            continue;
-
-        if (size < 0 && errno == EAGAIN) {
-            free(buffer);
-            return NULL;
-        }
-
-        if (size < 0) {
-            logger(LOG_ERR, "recvmsg: %s", strerror(errno));
-            free(buffer);
-            return NULL;
-        }
-
-        ifindex = 0;
-        found_ts = 0;
-        found_idx = 0;
-        for (cm = CMSG_FIRSTHDR(&m); cm; cm = CMSG_NXTHDR(&m, cm)) {
-            if (cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_PKTINFO) {
-                struct in_pktinfo *ipi = (void *) CMSG_DATA(cm);
-                ifindex = ipi->ipi_ifindex;
-                found_idx++;
-            }
-            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
-                memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
-                found_ts++;
-            }
-        }
-
-        if (!found_idx) {
-            logger(LOG_ERR, "couldn't find IP_PKTINFO data in auxiliary recvmsg() data!");
-            free(buffer);
+        if (input_recv(&dg) <= 0)
             return NULL;
-        }
 
-        if (!found_ts) {
-            logger(LOG_ERR, "couldn't find SCM_TIMESTAMPNS data in auxiliary recvmsg() data!");
-            free(buffer);
-            return NULL;
-        }
+        ts = dg.ts;
+        size = dg.size;
 
-        if (vban_parse(vban_header, size, &info) < 0) {
+        if (dg.info)
+            // already parsed by receive worker
+            info = *dg.info;
+        else
+        if (vban_parse(dg.header, size, &info) < 0) {
             logger(LOG_VRB, "malformed VBAN packet received");
             continue;
         }
@@ -255,7 +615,7 @@ struct stream *recvvban(int sock)
             continue;
         }
 
-        stream = getstream(&info, (struct sockaddr *) &addr, ifindex);
+        stream = getstream(&info, dg.addr, dg.ifindex);
         size -= VBAN_HEADER_SIZE;
 
         if (stream) {
@@ -297,20 +657,26 @@ struct stream *recvvban(int sock)
             stream->ts_last = ts;
 
         } else {
+            struct session *session;
             char peer[128];
             double pps;
 
+            // route stream by name
+            session = session_route(info.stream_name);
+            if (!session)
+                continue;
+
             // parse peer address
-            switch (((struct sockaddr *) &addr)->sa_family) {
+            switch (dg.addr->sa_family) {
                 case AF_INET: {
-                    struct sockaddr_in *in = (void *) &addr;
+                    struct sockaddr_in *in = (void *) dg.addr;
                     inet_ntop(AF_INET, &in->sin_addr, peer, sizeof(peer));
                     sprintf(peer + strlen(peer), ":%d", ntohs(in->sin_port));
                     break;
                 };
 #ifdef AF_INET6
                 case AF_INET6: {
-                    struct sockaddr_in6 *in6 = (void *) &addr;
+                    struct sockaddr_in6 *in6 = (void *) dg.addr;
                     peer[0] = '[';
                     inet_ntop(AF_INET6, &in6->sin6_addr, peer + 1, sizeof(peer) - 1);
                     sprintf(peer + strlen(peer), "]:%d", ntohs(in6->sin6_port));
@@ -326,16 +692,27 @@ struct stream *recvvban(int sock)
             stream = malloc(sizeof(struct stream));
             if (!stream) {
                 logger(LOG_ERR, "[%s] cannot allocate memory", info.stream_name);
-                free(buffer);
+                return NULL;
+            }
+
+            // reorder window, make sure packet buffers are ready before
+            // they are needed
+            stream->window_size = window;
+            stream->window = calloc(window, sizeof(struct packet));
+            if (!stream->window || pool_reserve(window) < 0) {
+                logger(LOG_ERR, "[%s] cannot allocate memory", info.stream_name);
+                free(stream->window);
+                free(stream);
                 return NULL;
             }
 
             // parse interface index
-            stream->ifindex = ifindex;
-            if_indextoname(ifindex, stream->ifname);
+            stream->ifindex = dg.ifindex;
+            if_indextoname(dg.ifindex, stream->ifname);
 
-            memcpy(&stream->peer, &addr, sizeof(struct sockaddr_storage));
+            memcpy(&stream->peer, dg.addr, sizeof(struct sockaddr_storage));
             strcpy(stream->name, info.stream_name);
+            stream->session = session;
 
             stream->frames = info.frames;
             stream->frame_size = info.frame_size;
@@ -346,10 +723,12 @@ struct stream *recvvban(int sock)
             stream->format = info.format;
             stream->format_name = info.format_name;
 
+            stream->packets = 0;
             stream->lost = 0;
+            stream->reordered = 0;
+            stream->dropped = 0;
             stream->expected = info.seq;
-            stream->curr.data = NULL;
-            stream->prev.data = NULL;
+            stream->released = info.seq;
             stream->ts_first = ts;
             stream->ts_last = ts;
 
@@ -357,7 +736,27 @@ struct stream *recvvban(int sock)
             stream->insync = 0;
             stream->offset = 0;
 
-            stream->next = NULL;
+            stream->correlated = 0;
+            stream->confidence = 1.0;
+            stream->xhist = NULL;
+
+            drift_start(stream, &ts, info.seq);
+            stream->drift_ppm = 0;
+
+            if (sync_init(stream) < 0 || xcorr_alloc(stream) < 0) {
+                logger(LOG_ERR, "[%s] cannot allocate memory", info.stream_name);
+                windowfree(stream);
+                sync_done(stream);
+                xcorr_free(stream);
+                free(stream);
+                return NULL;
+            }
+
+            stream->expected_last = info.seq;
+            stream->lost_last = 0;
+            stream->loss = 0;
+            stream->health = 1.0;
+            stream->timeout = STREAM_TIMEOUT_MSEC;
 
             // stats
             pps = (double) stream->sample_rate / (double) stream->frames;
@@ -370,30 +769,21 @@ struct stream *recvvban(int sock)
                    stream->name, stream->ifname, peer, stream->format_name,
                    stream->sample_rate, stream->channels);
 
-            if (streams) {
-                struct stream *tail = streams;
-                for (; tail->next; tail = tail->next);
-                tail->next = stream;
-            } else {
-                streams = stream;
-            }
-        }
+            stream->hash = streamhash(stream->name, dg.addr, dg.ifindex);
 
-        // save data to stream buffers
-        if (stream->expected == info.seq) {
-            if (stream->prev.data)
-                free(stream->prev.data);
-
-            stream->expected++;
-            stream->prev = stream->curr;
-            stream->curr.data = buffer;
-            stream->curr.sent = 0;
-            return stream;
+            if (addstream(stream) < 0) {
+                logger(LOG_ERR, "[%s] cannot allocate memory", info.stream_name);
+                windowfree(stream);
+                sync_done(stream);
+                xcorr_free(stream);
+                free(stream);
+                return NULL;
+            }
         }
 
-        // out of order packet received
+        stream->packets++;
 
-        // check sequence overflow
+        // packet number relative to expected, check sequence overflow
         delta = (int64_t) info.seq - (int64_t) stream->expected;
         delta1 = delta + 0x100000000L;
         delta2 = delta - 0x100000000L;
@@ -404,58 +794,76 @@ struct stream *recvvban(int sock)
         if (llabs(delta1) < llabs(delta))
             delta = delta1;
 
+        packet = &stream->window[info.seq & (stream->window_size - 1)];
+
         if (delta < 0) {
             // received lost packet
-            if (delta == -1 || (delta == -2 && stream->prev.data)) {
-                // duplicate
-                logger(LOG_DBG, "[%s@%s] expected %lu, got %lu: duplicate?",
+            if (-delta > stream->window_size) {
+                logger(LOG_DBG, "[%s@%s] expected %lu, got %lu: dropped",
                        stream->name, stream->ifname, (long unsigned) stream->expected,
                        (long unsigned) info.seq);
+                stream->dropped++;
                 continue;
             }
 
-            // received previous packet
-            if (delta == -2 && !stream->prev.data) {
-                // restore previous packet
-                stream->lost--;
-                stream->prev.data = buffer;
-                stream->prev.sent = 0;
-
-                logger(LOG_DBG, "[%s@%s] expected %lu, got %lu: restored",
+            if (packet->data && packet->seq == info.seq) {
+                // duplicate
+                logger(LOG_DBG, "[%s@%s] expected %lu, got %lu: duplicate?",
                        stream->name, stream->ifname, (long unsigned) stream->expected,
                        (long unsigned) info.seq);
-
-                return stream;
+                stream->dropped++;
+                continue;
             }
 
-            logger(LOG_DBG, "[%s@%s] expected %lu, got %lu: dropped",
+            // restore packet within the window
+            stream->lost--;
+            stream->reordered++;
+            packet->data = input_keep(&dg);
+            packet->seq = info.seq;
+            packet->sent = 0;
+
+            logger(LOG_DBG, "[%s@%s] expected %lu, got %lu: restored",
                    stream->name, stream->ifname, (long unsigned) stream->expected,
                    (long unsigned) info.seq);
-            continue;
+
+            release(stream, stream->expected - stream->window_size);
+            return stream;
         }
 
-        // lost packets
-        stream->lost += (long) delta;
-        if (delta == 1)
-            logger(LOG_DBG, "[%s@%s] expected %lu, got %lu: lost 1 packet",
-                   stream->name, stream->ifname, (long unsigned) stream->expected,
-                   (long unsigned) info.seq);
-        else
-            logger(LOG_DBG, "[%s@%s] expected %lu, got %lu: lost %lld packets",
-                   stream->name, stream->ifname, (long unsigned) stream->expected,
-                   (long unsigned) info.seq, (long long) delta);
+        if (delta > 0) {
+            // lost packets
+            stream->lost += (long) delta;
+            if (delta == 1)
+                logger(LOG_DBG, "[%s@%s] expected %lu, got %lu: lost 1 packet",
+                       stream->name, stream->ifname, (long unsigned) stream->expected,
+                       (long unsigned) info.seq);
+            else
+                logger(LOG_DBG, "[%s@%s] expected %lu, got %lu: lost %lld packets",
+                       stream->name, stream->ifname, (long unsigned) stream->expected,
+                       (long unsigned) info.seq, (long long) delta);
+        }
 
-        if (stream->prev.data)
-            free(stream->prev.data);
+        // packets leaving the window go to history, then free their slots
+        first = info.seq + 1 - (uint32_t) stream->window_size;
+        release(stream, first);
+
+        for (i = delta < stream->window_size ? delta : stream->window_size - 1; i >= 0; i--) {
+            struct packet *old = &stream->window[(info.seq - i) & (stream->window_size - 1)];
+
+            if (old->data) {
+                pool_put(old->data);
+                old->data = NULL;
+            }
+        }
 
-        if (stream->curr.data)
-            free(stream->curr.data);
+        drift_packet(stream, &ts, info.seq);
 
+        // save data to stream window
         stream->expected = info.seq + 1;
-        stream->prev.data = NULL;
-        stream->prev.sent = 0;
-        stream->curr.data = buffer;
-        stream->curr.sent = 0;
+        packet->data = input_keep(&dg);
+        packet->seq = info.seq;
+        packet->sent = 0;
+        release(stream, first);
         return stream;
     }
 }
@@ -33,8 +33,18 @@
  * Streams
  */
 
+#define STREAM_TIMEOUT_MSEC 700      // maximum and initial timeout
+#define STREAM_TIMEOUT_MIN_MSEC 100  // adaptive timeout lower bound
+#define STREAM_TIMEOUT_K 10.0        // timeout = average + k * stddev
+#define STREAM_WINDOW_DEFAULT 8      // reorder window, packets
+#define STREAM_WINDOW_MAX 256
+#define STREAM_DRIFT_BLOCKS 32       // clock drift estimation window, blocks
+
+struct session;
+
 struct packet {
     char *data; // packet data
+    uint32_t seq; // packet number
     int sent; // sent to output
 };
 
@@ -60,10 +70,14 @@ struct stream {
     char *format_name;         /* sample format name */
 
     // stream counters
+    long packets;              // packets received
     long lost;                 // total lost packets counter
+    long reordered;            // late packets restored within the window
+    long dropped;              // duplicates and packets too late for the window
     uint32_t expected;         // next expected packet number in this stream
-    struct packet curr;        // current packet in stream
-    struct packet prev;        // previous packet in stream
+    struct packet *window;     // reorder window, ring indexed by packet number
+    long window_size;          // packets in window, power of two
+    uint32_t released;         // next packet number to record in history
     struct timespec ts_first;  // first packet received time
     struct timespec ts_last;   // last packet received time
 
@@ -77,16 +91,58 @@ struct stream {
     long ignore;               // ignore this stream
     long insync;               // synchronized with primary stream
     int64_t offset;            // stream offset
+    char *history;             // recent consecutive packets, ring
+    uint32_t hist_seq;         // newest packet number in history
+    long hist_count;           // packets in history
+    long sync_attempts;        // offset searches made
+    double sync_msec;          // time from first packet to synchronization
+    int correlated;            // synchronized by cross-correlation, not bit-exact
+    double confidence;         // normalized correlation at offset
+    float *xhist;              // mono history for cross-correlation, ring
+    int64_t xhist_pos;         // frame position after the newest frame
+    long xhist_count;          // frames in mono history
+    uint64_t xcorr_token;      // identifies stream in correlation jobs
+
+    // sender clock drift, see drift.c
+    struct timespec drift_origin; // arrival time of reference packet
+    uint32_t drift_seq;        // reference packet number
+    int64_t drift_block;       // current block number
+    double drift_min;          // lowest arrival lag in current block, ns
+    double drift_at;           // arrival of that packet, ns since origin
+    double drift_t[STREAM_DRIFT_BLOCKS];   // recent block minima: arrival
+    double drift_lag[STREAM_DRIFT_BLOCKS]; // and lag, ring
+    long drift_blocks;         // minima recorded
+    double drift_ppm;          // sender clock rate error, parts per million
+
+    // lookup
+    uint32_t hash;             // stream key hash
 
-    // next stream
+    // health, updated every second
+    uint32_t expected_last;    // expected at last update
+    long lost_last;            // lost at last update
+    double loss;               // lost packets ratio, EWMA
+    double health;             // 1.0 for perfect stream, lower is worse
+
+    // expiration
+    long timeout;              // offline after timeout msec without packets
+    int64_t expires;           // scheduled expiration check, msec
+    struct stream *wheel_next; // timer wheel slot list
+    struct stream **wheel_pprev;
+
+    // owning session, next stream in it
+    struct session *session;
     struct stream *next;
 };
 
-extern struct stream *streams;
-
-void forgetstreams(void);
+int addstream(struct stream *);
+void promotestream(struct stream *);
+void streamswindow(long packets);
+void streamshealth(struct session *session, double k);
+void forgetstreams(struct session *session);
 void forgetstream(struct stream *);
 struct stream *getstream(struct vbaninfo *, struct sockaddr *, unsigned ifindex);
-struct stream *recvvban(int);
+struct stream *recvvban(void);
+struct stream *expiredstream(struct timespec *now);
+int64_t nextexpiry(void);
 
 #endif
@@ -0,0 +1,200 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sync.h"
+
+// polynomial hash multiplier, arithmetic is modulo 2^64
+#define SYNC_BASE 0x100000001b3ULL
+
+
+static inline char *slot(struct stream *stream, uint32_t seq)
+{
+    return stream->history + (seq % SYNC_HISTORY) * stream->pktsize;
+}
+
+
+int sync_init(struct stream *stream)
+{
+    stream->history = malloc(SYNC_HISTORY * stream->pktsize);
+    stream->hist_seq = 0;
+    stream->hist_count = 0;
+    stream->sync_attempts = 0;
+    stream->sync_msec = 0;
+
+    return stream->history ? 0 : -1;
+}
+
+
+void sync_done(struct stream *stream)
+{
+    free(stream->history);
+    stream->history = NULL;
+}
+
+
+/*
+ * Save packet to stream history, history restarts after a gap
+ */
+void sync_record(struct stream *stream, uint32_t seq, const char *data)
+{
+    if (stream->hist_count && seq != stream->hist_seq + 1)
+        stream->hist_count = 0;
+
+    memcpy(slot(stream, seq), data, stream->pktsize);
+    stream->hist_seq = seq;
+
+    if (stream->hist_count < SYNC_HISTORY)
+        stream->hist_count++;
+}
+
+
+/*
+ * Compare one packet of data with stream history at frame position pos:
+ * 0 if equal, 1 if not, -1 if position is out of history
+ */
+static int histcmp(struct stream *stream, int64_t pos, const char *data)
+{
+    int64_t first = ((int64_t) stream->hist_seq - stream->hist_count + 1) * stream->frames;
+    int64_t last = ((int64_t) stream->hist_seq + 1) * stream->frames;
+    int64_t seq = pos / stream->frames;
+    long off = (pos - seq * stream->frames) * stream->frame_size;
+    long len = stream->pktsize - off;
+
+    if (pos < first || pos + stream->frames > last)
+        return -1;
+
+    if (memcmp(slot(stream, seq) + off, data, len))
+        return 1;
+
+    if (off && memcmp(slot(stream, seq + 1), data + len, off))
+        return 1;
+
+    return 0;
+}
+
+
+/*
+ * Find the newest packet of stream1 in stream2 history with a rolling
+ * hash, one pass over the history. Returns matches at frame boundaries,
+ * counting stops at 2, first match position in stream2 frames
+ */
+static int search(struct stream *stream1, struct stream *stream2, int64_t *pos)
+{
+    const unsigned char *needle = (void *) slot(stream1, stream1->hist_seq);
+    const unsigned char *prv, *cur;
+    int64_t seq = (int64_t) stream2->hist_seq - stream2->hist_count + 1;
+    uint64_t hn = 0, h = 0, top = 1;
+    long size = stream2->pktsize;
+    long w = stream2->frame_size;
+    long k, b, f;
+    int matches = 0;
+
+    for (b = 0; b < size; b++) {
+        hn = hn * SYNC_BASE + needle[b];
+        top *= SYNC_BASE;
+    }
+
+    // oldest packet of history
+    prv = (void *) slot(stream2, seq);
+    for (b = 0; b < size; b++)
+        h = h * SYNC_BASE + prv[b];
+
+    if (h == hn && !memcmp(prv, needle, size)) {
+        *pos = seq * stream2->frames;
+        matches++;
+    }
+
+    // slide window byte by byte, check at frame boundaries
+    for (k = 1; k < stream2->hist_count && matches < 2; k++) {
+        cur = (void *) slot(stream2, seq + k);
+
+        for (b = 0, f = w; b < size; b++) {
+            h = h * SYNC_BASE + cur[b] - prv[b] * top;
+
+            if (--f)
+                continue;
+            f = w;
+
+            // window: prv[b + 1 .. size) + cur[0 .. b]
+            if (h != hn ||
+                memcmp(prv + b + 1, needle, size - b - 1) ||
+                memcmp(cur, needle + size - b - 1, b + 1))
+                continue;
+
+            if (!matches)
+                *pos = (seq + k - 1) * stream2->frames + (b + 1) / w;
+
+            if (++matches > 1)
+                break;
+        }
+
+        prv = cur;
+    }
+
+    return matches;
+}
+
+
+/*
+ * Find offset of stream2 relative to stream1: -1 if streams are
+ * incompatible, 0 if not found (yet), 1 if found and confirmed,
+ * 2 if ambiguous (i.e. silence)
+ */
+int syncstreams(struct stream *stream1, struct stream *stream2, int64_t *offset)
+{
+    int64_t pos = 0;
+    int matches, i;
+
+    // compare streams
+    if (stream1->frames != stream2->frames ||
+        stream1->format != stream2->format ||
+        stream1->channels != stream2->channels ||
+        stream1->sample_rate != stream2->sample_rate)
+        return -1;
+
+    if (!stream1->hist_count || stream2->hist_count < 2)
+        // not enough consequitive packets
+        return 0;
+
+    matches = search(stream1, stream2, &pos);
+    if (matches != 1)
+        return matches;
+
+    // older packets of stream1 must match too
+    for (i = 1; i < SYNC_CONFIRM; i++) {
+        if (i >= stream1->hist_count)
+            return 0;
+
+        // mismatch or out of stream2 history, wait for more packets
+        if (histcmp(stream2, pos - i * stream1->frames,
+                    slot(stream1, stream1->hist_seq - i)))
+            return 0;
+    }
+
+    *offset = pos - (int64_t) stream1->hist_seq * stream1->frames;
+
+    return 1;
+}
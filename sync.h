@@ -0,0 +1,41 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#ifndef _SYNC_H
+#define _SYNC_H 1
+
+#include <stdint.h>
+#include "streams.h"
+
+/*
+ * Streams synchronization
+ */
+
+#define SYNC_HISTORY 32    // packets kept per stream for offset search
+#define SYNC_CONFIRM 3     // consecutive packets matching at found offset
+
+int sync_init(struct stream *stream);
+void sync_done(struct stream *stream);
+void sync_record(struct stream *stream, uint32_t seq, const char *data);
+int syncstreams(struct stream *stream1, struct stream *stream2, int64_t *offset);
+
+#endif
@@ -0,0 +1,294 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+
+static int sys_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+
+static int sys_enter(int fd, unsigned submit, unsigned complete, unsigned flags,
+                     void *arg, size_t argsz)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, submit, complete, flags, arg, argsz);
+}
+
+
+static int sys_register(int fd, unsigned opcode, void *arg, unsigned nr)
+{
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr);
+}
+
+
+int uring_init(struct uring *u, unsigned entries, unsigned cq_entries)
+{
+    struct io_uring_params p;
+    int err;
+
+    bzero(u, sizeof(struct uring));
+    bzero(&p, sizeof(p));
+
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = cq_entries;
+
+    u->fd = sys_setup(entries, &p);
+    if (u->fd < 0)
+        return -1;
+
+    // waiting with timeout needs IORING_ENTER_EXT_ARG
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        close(u->fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+
+    if (u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED || u->sqes == MAP_FAILED) {
+        err = errno;
+        uring_exit(u);
+        errno = err;
+        return -1;
+    }
+
+    u->sq_head = (unsigned *) ((char *) u->sq_ring + p.sq_off.head);
+    u->sq_tail = (unsigned *) ((char *) u->sq_ring + p.sq_off.tail);
+    u->sq_mask = (unsigned *) ((char *) u->sq_ring + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *) ((char *) u->sq_ring + p.sq_off.array);
+
+    u->cq_head = (unsigned *) ((char *) u->cq_ring + p.cq_off.head);
+    u->cq_tail = (unsigned *) ((char *) u->cq_ring + p.cq_off.tail);
+    u->cq_mask = (unsigned *) ((char *) u->cq_ring + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *) ((char *) u->cq_ring + p.cq_off.cqes);
+
+    return 0;
+}
+
+
+void uring_exit(struct uring *u)
+{
+    if (u->br && u->br != MAP_FAILED)
+        munmap(u->br, u->br_size);
+
+    if (u->sqes && u->sqes != MAP_FAILED)
+        munmap(u->sqes, u->sqes_size);
+
+    if (u->cq_ring && u->cq_ring != MAP_FAILED)
+        munmap(u->cq_ring, u->cq_ring_size);
+
+    if (u->sq_ring && u->sq_ring != MAP_FAILED)
+        munmap(u->sq_ring, u->sq_ring_size);
+
+    if (u->fd >= 0)
+        close(u->fd);
+
+    bzero(u, sizeof(struct uring));
+    u->fd = -1;
+}
+
+
+/*
+ * Get next free submission entry, NULL if queue is full
+ */
+struct io_uring_sqe *uring_sqe(struct uring *u)
+{
+    unsigned tail = *u->sq_tail + u->sq_pending;
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    struct io_uring_sqe *sqe;
+
+    if (tail - head > *u->sq_mask)
+        return NULL;
+
+    sqe = &u->sqes[tail & *u->sq_mask];
+    bzero(sqe, sizeof(struct io_uring_sqe));
+
+    u->sq_array[tail & *u->sq_mask] = tail & *u->sq_mask;
+    u->sq_pending++;
+
+    return sqe;
+}
+
+
+/*
+ * Submit pending entries and wait for at least one completion:
+ * 1 if completions are available, 0 on timeout, -1 on error
+ */
+int uring_wait(struct uring *u, int timeout_msec)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned submit;
+    int rc;
+
+    submit = u->sq_pending;
+    if (submit) {
+        __atomic_store_n(u->sq_tail, *u->sq_tail + submit, __ATOMIC_RELEASE);
+        u->sq_pending = 0;
+    }
+
+    if (!submit && uring_cqe(u))
+        return 1;
+
+    ts.tv_sec = timeout_msec / 1000;
+    ts.tv_nsec = (timeout_msec % 1000) * 1000000L;
+
+    // negative timeout waits forever
+    bzero(&arg, sizeof(arg));
+    if (timeout_msec >= 0)
+        arg.ts = (uint64_t) (uintptr_t) &ts;
+
+    while (1) {
+        rc = sys_enter(u->fd, submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                       &arg, sizeof(arg));
+
+        if (rc >= 0) {
+            submit = 0;
+            if (uring_cqe(u))
+                return 1;
+            continue;
+        }
+
+        if (errno == EINTR)
+            continue;
+
+        if (errno == ETIME)
+            return uring_cqe(u) ? 1 : 0;
+
+        return -1;
+    }
+}
+
+
+/*
+ * Submit pending entries without waiting
+ */
+int uring_submit(struct uring *u)
+{
+    unsigned submit = u->sq_pending;
+    int rc;
+
+    if (!submit)
+        return 0;
+
+    __atomic_store_n(u->sq_tail, *u->sq_tail + submit, __ATOMIC_RELEASE);
+    u->sq_pending = 0;
+
+    do {
+        rc = sys_enter(u->fd, submit, 0, 0, NULL, 0);
+    } while (rc < 0 && errno == EINTR);
+
+    return rc < 0 ? -1 : 0;
+}
+
+
+/*
+ * Peek next completion, NULL if none
+ */
+struct io_uring_cqe *uring_cqe(struct uring *u)
+{
+    unsigned head = *u->cq_head;
+
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    return &u->cqes[head & *u->cq_mask];
+}
+
+
+void uring_cqe_seen(struct uring *u)
+{
+    __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Register provided buffers ring with group id bgid
+ */
+int uring_buf_ring(struct uring *u, unsigned entries, int bgid)
+{
+    struct io_uring_buf_reg reg;
+
+    u->br_size = entries * sizeof(struct io_uring_buf);
+    u->br = mmap(NULL, u->br_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (u->br == MAP_FAILED) {
+        u->br = NULL;
+        return -1;
+    }
+
+    bzero(&reg, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) u->br;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+
+    if (sys_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return -1;
+
+    u->br_mask = entries - 1;
+    u->br_tail = 0;
+
+    return 0;
+}
+
+
+/*
+ * Add buffer to the provided buffers ring, visible after uring_buf_commit()
+ */
+void uring_buf_add(struct uring *u, void *addr, unsigned len, unsigned short bid)
+{
+    struct io_uring_buf *buf = &u->br->bufs[u->br_tail & u->br_mask];
+
+    buf->addr = (uint64_t) (uintptr_t) addr;
+    buf->len = len;
+    buf->bid = bid;
+
+    u->br_tail++;
+}
+
+
+void uring_buf_commit(struct uring *u)
+{
+    __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
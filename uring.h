@@ -0,0 +1,76 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#ifndef _URING_H
+#define _URING_H 1
+
+#include <linux/io_uring.h>
+
+/*
+ * Minimal io_uring wrapper: one submission/completion ring pair and
+ * one provided buffers ring
+ */
+
+struct uring {
+    int fd;
+
+    // submission queue
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_pending;
+
+    // completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // provided buffers ring
+    struct io_uring_buf_ring *br;
+    unsigned br_mask;
+    unsigned short br_tail;
+
+    // mappings
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    size_t br_size;
+};
+
+int uring_init(struct uring *u, unsigned entries, unsigned cq_entries);
+void uring_exit(struct uring *u);
+struct io_uring_sqe *uring_sqe(struct uring *u);
+int uring_wait(struct uring *u, int timeout_msec);
+int uring_submit(struct uring *u);
+struct io_uring_cqe *uring_cqe(struct uring *u);
+void uring_cqe_seen(struct uring *u);
+
+int uring_buf_ring(struct uring *u, unsigned entries, int bgid);
+void uring_buf_add(struct uring *u, void *addr, unsigned len, unsigned short bid);
+void uring_buf_commit(struct uring *u);
+
+#endif
@@ -89,3 +89,21 @@ int vban_parse(const void *buffer, ssize_t size, struct vbaninfo *info)
 
     return 0;
 }
+
+
+int vban_format(const char *name)
+{
+    int i;
+
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+        if (formats[i].ss && !strcmp(formats[i].name, name))
+            return i;
+
+    return -1;
+}
+
+
+char *vban_format_name(long format)
+{
+    return formats[format & 0x07].name;
+}
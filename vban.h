@@ -86,5 +86,7 @@ struct vbaninfo {
 #define VBAN_CODEC_USER           0xF0
 
 extern int vban_parse(const void *buffer, ssize_t size, struct vbaninfo *info);
+extern int vban_format(const char *name);
+extern char *vban_format_name(long format);
 
 #endif /* vban.h */
@@ -20,6 +20,7 @@
  *  USA.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -29,32 +30,67 @@
 #include <signal.h>
 #include <errno.h>
 #include <time.h>
+#include <math.h>
 
 #include <alloca.h>
+#include <sched.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
 #include <fcntl.h>
 
 #include "vban.h"
 #include "streams.h"
+#include "input.h"
 #include "output.h"
+#include "pool.h"
 #include "logger.h"
 #include "httpd.h"
+#include "loop.h"
+#include "silence.h"
+#include "convert.h"
+#include "resample.h"
+#include "conceal.h"
+#include "sync.h"
+#include "xcorr.h"
+#include "writer.h"
+#include "session.h"
 
 
-#define STREAM_TIMEOUT_MSEC 700
 #define BUFFER_OUT_PACKETS 2
 
+// backup replaces primary if it is healthier by margin
+#define PROMOTE_HEALTH 0.02
+#define PROMOTE_UPTIME 3
+// seconds between health promotions, no flapping between similar streams
+#define PROMOTE_INTERVAL 10
+
 
 /*
  * global vars
  */
 
-static char *pipename = NULL;
 static char *onconnect = NULL;
 static char *ondisconnect = NULL;
+static double timeout_k = STREAM_TIMEOUT_K;
+static long silent_secs = OUTPUT_SILENT_SECS;
+static long latency = OUTPUT_LATENCY_MSEC;
+static double correlation = 0; // minimal confidence, 0 disables
+static long format = -1;        // output sample format, -1 is primary's
+static long drift = 0;          // reader fill level to keep, msec, 0 disables
+static int policy = CONCEAL_SILENCE; // lost frames concealment
+
+// cpus allowed before pinning, restored for hooks
+static cpu_set_t allcpus;
+static int pinned = 0;
+
+// streams expiration timer
+static int tfd = -1;
+static int64_t armed = INT64_MAX;
 
 
 static void error(char *msg, int err)
@@ -64,8 +100,48 @@ static void error(char *msg, int err)
 }
 
 
+static void usage(char *prog)
+{
+    logger(LOG_ERR, "usage: %s [options] <port> <pipe> [exec-on-connect] [exec-on-disconnect]\n"
+                    "options:\n"
+                    "  -b <count>  receive up to <count> datagrams per syscall (default %d)\n"
+                    "  -B <usec>   busy poll socket for <usec> microseconds (epoll busy\n"
+                    "              polling needs linux 6.9+ unless -j is used)\n"
+                    "  -c <cpu>    pin receive and output thread to <cpu>\n"
+                    "  -C <policy> conceal lost frames: none (skip them), silence (default),\n"
+                    "              repeat (last waveform period) or lpc (linear prediction)\n"
+                    "  -d <msec>   compensate clock drift: resample to keep <msec> of audio\n"
+                    "              queued for the pipe reader\n"
+                    "  -e <engine> receive engine: mmsg (default) or uring\n"
+                    "  -f <format> output sample format: u8, s16le, s24le, s32le, float32le\n"
+                    "              or float64le (default: primary stream's format)\n"
+                    "  -g          receive coalesced datagrams (UDP_GRO, mmsg engine)\n"
+                    "  -H          use huge pages for packet buffers\n"
+                    "  -j <count>  receive in <count> worker threads (SO_REUSEPORT)\n"
+                    "  -k <k>      stream timeout is average + <k> * stddev interval (default %.0f)\n"
+                    "  -l <msec>   jitter buffer latency ceiling (default %d)\n"
+                    "  -p <bytes>  set pipe buffer size (F_SETPIPE_SZ)\n"
+                    "  -r <prio>   realtime mode: SCHED_FIFO priority <prio>, locked memory\n"
+                    "  -s <secs>   close pipe after <secs> of silence, 0 to keep open (default %d)\n"
+                    "  -S <pattern>:<pipe>\n"
+                    "              route streams with names matching <pattern> to a session of\n"
+                    "              their own writing to <pipe>, repeat for more pipes; <pipe>\n"
+                    "              argument takes the rest, \"-\" to ignore them\n"
+                    "  -t <dBFS>   silence threshold, e.g. -80 (default: digital silence only)\n"
+                    "  -T <pipe>   also write to <pipe>, up to %d pipes in total\n"
+                    "  -w <count>  reorder window, accept packets up to <count> late (default %d)\n"
+                    "  -x <conf>   sync near-identical backups by cross-correlation, minimal\n"
+                    "              confidence <conf>, e.g. 0.9 (default: bit-exact only)\n"
+                    "  -z          zero-copy output, vmsplice() to the pipe",
+           prog, INPUT_BATCH_DEFAULT, STREAM_TIMEOUT_K, OUTPUT_LATENCY_MSEC, OUTPUT_SILENT_SECS,
+           WRITER_TARGETS_MAX, STREAM_WINDOW_DEFAULT);
+    exit(1);
+}
+
+
 static void runhook(char *prog)
 {
+    struct sched_param param;
     char *argv[2];
     pid_t pid = fork();
 
@@ -74,6 +150,12 @@ static void runhook(char *prog)
             logger(LOG_ERR, "exec failed, unable to fork: %s", strerror(errno));
             return;
         case 0:
+            // hooks never run realtime or on the receive cpu
+            param.sched_priority = 0;
+            sched_setscheduler(0, SCHED_OTHER, &param);
+            if (pinned)
+                sched_setaffinity(0, sizeof(allcpus), &allcpus);
+
             argv[0] = prog;
             argv[1] = NULL;
             execvp(prog, argv);
@@ -84,212 +166,390 @@ static void runhook(char *prog)
 }
 
 
-static int syncstreams(struct stream *stream1, struct stream *stream2, int64_t *offset)
+static void process(struct stream *stream)
 {
-    int i, w, matches;
-    long size = stream2->pktsize;
-    char *data1, data2[size * 2];
-
-    // compare streams
-    if (stream1->frames != stream2->frames ||
-        stream1->format != stream2->format ||
-        stream1->channels != stream2->channels ||
-        stream1->sample_rate != stream2->sample_rate)
-        return -1;
-
-    // try to find last packet of stream1
-    // in the last two packets of stream2
-
-    if (!stream2->prev.data)
-        // not enough consequitive packets in stream2
-        return 0;
-
-    data1 = stream1->curr.data;
-    memcpy(data2, stream2->prev.data, size);
-    memcpy(data2 + size, stream2->curr.data, size);
-
-    matches = 0;
-    w = stream1->sample_size * stream1->channels;
-    for (i = 0; i <= size; i += w)
-        if (!memcmp(data1, data2 + i, size)) {
-            if (matches == 0) {
-                *offset = (int64_t) stream2->expected - 1;
-                *offset -= (int64_t) stream1->expected;
-                *offset *= stream1->frames;
-                *offset += i / w;
-            }
-            matches++;
+    struct session *session = stream->session;
+    struct stream *primary = session->streams;
+    long back;
+
+    // ignore stream
+    if (stream->ignore)
+        return;
+
+    // stream sync paused
+    if (stream->insync < 0) {
+        stream->insync++;
+        return;
+    }
+
+    // search offset in recent packets, online once confirmed
+    if (stream->insync < 3) {
+        int64_t offset;
+        int matches;
+
+        if (stream == primary) {
+            logger(LOG_INF, "[%s@%s] stream online, primary",
+                   stream->name, stream->ifname);
+
+            if (output_init(session->output, session->pipenames, session->npipes,
+                            stream, format, silent_secs, latency, drift, policy) < 0)
+                error("pipe open", errno);
+
+            if (onconnect)
+                runhook(onconnect);
+
+            stream->insync = 3;
+            return;
         }
 
-    return matches;
-}
+        matches = syncstreams(primary, stream, &offset);
+
+        // other sample format, only correlation can match it; packet size
+        // must match, playback positions and the jitter buffer depend on it
+        if (matches < 0 && !(correlation > 0 &&
+                             stream->frames == primary->frames &&
+                             stream->channels == primary->channels &&
+                             stream->sample_rate == primary->sample_rate)) {
+            logger(LOG_INF, "[%s@%s] stream didnt match primary stream, ignoring",
+                   stream->name, stream->ifname);
+            stream->ignore++;
+            return;
+        }
 
+        if (matches == 0) {
+            matches = syncstreams(stream, primary, &offset);
+            offset = -offset;
+        }
 
-static void run(int sock)
-{
-    struct stream *stream, *dead;
-    time_t stat_sec = 0;
+        stream->sync_attempts++;
 
-    for (;;) {
-        stream = recvvban(sock);
+        if (matches == 1) {
+            stream->insync = 3;
+            stream->offset = offset;
+            stream->sync_msec = (stream->ts_last.tv_sec - stream->ts_first.tv_sec) * 1000.0 +
+                                (stream->ts_last.tv_nsec - stream->ts_first.tv_nsec) / 1000000.0;
 
-        if (!stream)
+            logger(LOG_INF, "[%s@%s] stream online, offset %lld frames, synchronized in %.1f ms",
+                   stream->name, stream->ifname, (long long) offset, stream->sync_msec);
             return;
+        }
 
-        // snapshot streams every second
-        if (stream->ts_last.tv_sec != stat_sec) {
-            stat_sec = stream->ts_last.tv_sec;
-            httpd_update(streams);
+        if (matches <= 0 && stream->hist_count == SYNC_HISTORY &&
+            primary->hist_count == SYNC_HISTORY) {
+            // not bit-exact, try cross-correlation in background
+            if (correlation > 0)
+                xcorr_submit(primary, stream);
+
+            // whole history searched, pause (~100ms) stream for a while
+            stream->insync = -(long) (stream->sample_rate / stream->frames / 10);
         }
 
-        // check dead streams
-        for (dead = streams; dead; dead = dead->next) {
-            long msec;
+        return;
+    }
 
-            // skip current stream
-            if (dead == stream)
-                continue;
+    // play window packets in order, late ones once they arrive
+    for (back = stream->window_size; back > 0; back--) {
+        uint32_t seq = stream->expected - (uint32_t) back;
+        struct packet *packet = &stream->window[seq & (stream->window_size - 1)];
 
-            msec = (long) (stream->ts_last.tv_sec - dead->ts_last.tv_sec) * 1000L;
-            msec += (long) (stream->ts_last.tv_nsec - dead->ts_last.tv_nsec) / 1000000L;
+        if (!packet->data || packet->seq != seq || packet->sent)
+            continue;
 
-            if (msec < STREAM_TIMEOUT_MSEC)
-                continue;
+        output_play(session->output,
+                    stream->frames * ((int64_t) stream->expected - back + 1) - stream->offset,
+                    packet->data, stream->frames, stream->format,
+                    stream->correlated);
+        packet->sent++;
+    }
+}
 
-            if (dead == streams) {
-                // primary stream died
-                // fix offsets and output position
-                struct stream *curr;
-                int64_t delta;
 
-                if (!streams->next)
-                    // last stream timed out
-                    return;
+/*
+ * Apply finished cross-correlation, backup goes online if confident
+ */
+static void correlated(void)
+{
+    struct xcorr_result result;
+    struct session *session;
+    struct stream *stream;
 
-                delta = dead->next->offset;
+    if (!xcorr_poll(&result))
+        return;
 
-                for (curr = dead->next; curr; curr = curr->next)
-                    curr->offset -= delta;
+    // primary changed or backup gone meanwhile
+    for (session = sessions; session; session = session->next)
+        if (session->streams && session->streams->xcorr_token == result.primary)
+            break;
 
-                output_move(delta);
-            }
+    if (!session)
+        return;
 
-            forgetstream(dead);
-        }
+    for (stream = session->streams->next; stream; stream = stream->next)
+        if (stream->xcorr_token == result.backup)
+            break;
 
-        // ignore stream
-        if (stream->ignore)
-            continue;
+    if (!stream || stream->ignore || stream->insync >= 3)
+        return;
+
+    if (result.confidence < correlation) {
+        logger(LOG_VRB, "[%s@%s] correlation %.3f at offset %lld frames, too low",
+               stream->name, stream->ifname, result.confidence, (long long) result.offset);
+        return;
+    }
+
+    stream->insync = 3;
+    stream->offset = result.offset;
+    stream->correlated = 1;
+    stream->confidence = result.confidence;
+    stream->sync_msec = (stream->ts_last.tv_sec - stream->ts_first.tv_sec) * 1000.0 +
+                        (stream->ts_last.tv_nsec - stream->ts_first.tv_nsec) / 1000000.0;
+
+    logger(LOG_INF, "[%s@%s] stream online, offset %lld frames, correlation %.3f, synchronized in %.1f ms",
+           stream->name, stream->ifname, (long long) result.offset, result.confidence,
+           stream->sync_msec);
+}
+
+
+/*
+ * Healthiest synchronized backup stream, bit-exact ones first, NULL if none
+ */
+static struct stream *bestbackup(struct session *session)
+{
+    struct stream *stream, *best = NULL;
 
-        // stream sync paused
-        if (stream->insync < 0) {
-            stream->insync++;
+    for (stream = session->streams->next; stream; stream = stream->next) {
+        if (stream->ignore || stream->insync < 3)
             continue;
-        }
 
-        // require 3 successfully attempts to sync
-        if (stream->insync < 3) {
-            int64_t offset;
-            int matches;
+        if (!best || stream->correlated < best->correlated ||
+            (stream->correlated == best->correlated && stream->health > best->health))
+            best = stream;
+    }
 
-            if (stream == streams) {
-                logger(LOG_INF, "[%s@%s] stream online, primary",
-                       stream->name, stream->ifname);
+    return best;
+}
 
-                if (output_init(pipename, stream, 5) < 0)
-                    error("pipe open", errno);
 
-                if (onconnect)
-                    runhook(onconnect);
+/*
+ * Make stream primary, fix offsets and output position
+ */
+static void setprimary(struct stream *stream)
+{
+    struct stream *curr;
+    int64_t delta = stream->offset;
 
-                stream->insync = 3;
-                continue;
-            }
+    for (curr = stream->session->streams; curr; curr = curr->next) {
+        curr->offset -= delta;
 
-            matches = syncstreams(streams, stream, &offset);
+        // exact copies of old primary are only close to the new one
+        if (stream->correlated && curr != stream)
+            curr->correlated = 1;
+    }
 
-            if (matches < 0) {
-                logger(LOG_INF, "[%s@%s] stream didnt match primary stream, ignoring",
-                       stream->name, stream->ifname);
-                stream->ignore++;
-                continue;
-            }
+    stream->correlated = 0;
 
-            if (matches == 0) {
-                matches = syncstreams(stream, streams, &offset);
-                offset = -offset;
-            }
+    output_move(stream->session->output, delta);
+    promotestream(stream);
 
-            if (matches == 1) {
-                if (stream->insync++ && stream->offset != offset) {
-                    // offset mismatch, pause (~100ms) and try to sync again
-                    stream->insync = -(long) (stream->sample_rate / stream->frames / 10);
-                    continue;
-                }
+    stream->session->promoted = stream->ts_last.tv_sec;
+}
 
-                if (stream->insync == 3)
-                    logger(LOG_INF, "[%s@%s] stream online, offset %lld frames",
-                           stream->name, stream->ifname, (long long) offset);
 
-                stream->offset = offset;
-            } else {
-                if (stream->insync == 0)
-                    // still cant sync, pause (~100ms) stream for a while
-                    stream->insync = -(long) (stream->sample_rate / stream->frames / 10);
-            }
+/*
+ * Update streams health and jitter buffer depth, promote healthier backup
+ */
+static void checkhealth(struct session *session)
+{
+    struct stream *primary = session->streams;
+    struct stream *stream, *best;
+    double jitter = 0;
 
-            continue;
-        }
+    if (!primary)
+        return;
 
-        if (stream->prev.data && !stream->prev.sent) {
-            output_play(stream->frames * (stream->expected - 1) - stream->offset,
-                        stream->prev.data, stream->frames, stream->frame_size);
-            stream->prev.sent++;
-        }
+    streamshealth(session, timeout_k);
 
-        if (!stream->curr.sent) {
-            output_play(stream->frames * stream->expected - stream->offset,
-                        stream->curr.data, stream->frames, stream->frame_size);
-            stream->curr.sent++;
-        }
+    // jitter buffer covers the worst synchronized stream
+    for (stream = primary; stream; stream = stream->next)
+        if (!stream->ignore && stream->insync >= 3 && jitter < sqrt(stream->dt_variance))
+            jitter = sqrt(stream->dt_variance);
+
+    output_adapt(session->output, jitter);
+    output_drift(session->output, primary->drift_ppm);
+
+    best = bestbackup(session);
+
+    if (!best) {
+        // nothing to fail over to, wait for full timeout
+        primary->timeout = STREAM_TIMEOUT_MSEC;
+        return;
     }
+
+    if (best->correlated || best->health < primary->health + PROMOTE_HEALTH)
+        return;
+
+    if (best->ts_last.tv_sec - best->ts_first.tv_sec < PROMOTE_UPTIME)
+        return;
+
+    if (best->ts_last.tv_sec - session->promoted < PROMOTE_INTERVAL)
+        return;
+
+    logger(LOG_INF, "[%s@%s] stream promoted to primary, health %.3f, was %.3f",
+           best->name, best->ifname, best->health, primary->health);
+
+    setprimary(best);
 }
 
 
-int main(int argc, char **argv)
+/*
+ * Disconnect all session streams
+ */
+static void disconnect(struct session *session)
 {
-    struct sockaddr_in addr;
-    struct timeval timeout;
-    int vbsock, httpdsock;
-    int port, optval;
+    forgetstreams(session);
 
-    logger_init();
+    if (output_done(session->output) < 0)
+        error("pipe close", errno);
 
-    signal(SIGPIPE, SIG_IGN);
-    signal(SIGCHLD, SIG_IGN);
+    if (ondisconnect)
+        runhook(ondisconnect);
 
-    // check command line arguments
-    if (argc < 3) {
-        logger(LOG_ERR, "usage: %s <port> <pipe> [exec-on-connect] [exec-on-disconnect]", argv[0]);
-        return 1;
+    // update streams stats
+    httpd_update(sessions);
+}
+
+
+/*
+ * Arm expiration timer for the next wheel slot
+ */
+static void armtimer(void)
+{
+    struct itimerspec its;
+    int64_t next = nextexpiry();
+
+    if (next == armed)
+        return;
+
+    // zero value disarms timer
+    bzero(&its, sizeof(its));
+    if (next != INT64_MAX) {
+        its.it_value.tv_sec = next / 1000;
+        its.it_value.tv_nsec = (next % 1000) * 1000000L;
     }
 
-    // parse port
-    port = atoi(argv[1]);
-    if (port <= 0 || port > 65535) {
-        logger(LOG_ERR, "bad port: %s", argv[1]);
-        return 1;
+    if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+        error("timerfd_settime", errno);
+
+    armed = next;
+}
+
+
+/*
+ * Datagrams are ready
+ */
+static void onreceive(int fd, uint32_t events, void *arg)
+{
+    static time_t stat_sec = 0;
+    struct session *session;
+    struct stream *stream;
+
+    while ((stream = recvvban())) {
+        if (correlation > 0)
+            correlated();
+
+        // check health and snapshot streams every second
+        if (stream->ts_last.tv_sec != stat_sec) {
+            stat_sec = stream->ts_last.tv_sec;
+            for (session = sessions; session; session = session->next)
+                checkhealth(session);
+            httpd_update(sessions);
+        }
+
+        process(stream);
     }
 
-    // setup pipename, connect/disconnect handlers
-    if (!(pipename = strdup(argv[2])))
-        error("strdup", ENOMEM);
+    // new streams
+    armtimer();
+}
 
-    if (argc > 3 && !(onconnect = strdup(argv[3])))
-        error("strdup", ENOMEM);
 
-    if (argc > 4 && !(ondisconnect = strdup(argv[4])))
-        error("strdup", ENOMEM);
+/*
+ * Expiration timer fired, forget dead streams
+ */
+static void onexpire(int fd, uint32_t events, void *arg)
+{
+    struct stream *dead;
+    struct timespec now;
+    uint64_t value;
+
+    if (read(fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+        logger(LOG_ERR, "timerfd read: %s", strerror(errno));
+
+    armed = INT64_MAX;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    while ((dead = expiredstream(&now))) {
+        if (dead == dead->session->streams) {
+            // primary stream died, switch to the healthiest backup
+            struct stream *next = bestbackup(dead->session);
+
+            if (!next) {
+                // no synchronized backup, others start over as new streams
+                disconnect(dead->session);
+                continue;
+            }
+
+            setprimary(next);
+        }
+
+        forgetstream(dead);
+    }
+
+    armtimer();
+}
+
+
+/*
+ * Realtime mode: SCHED_FIFO priority and locked memory
+ */
+static void realtime(int prio)
+{
+    struct sched_param param;
+    int rc;
+
+    param.sched_priority = prio;
+    if ((rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)))
+        logger(LOG_ERR, "cannot set SCHED_FIFO priority %d: %s", prio, strerror(rc));
+
+    // no page faults on the receive path
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+        logger(LOG_ERR, "mlockall failed: %s", strerror(errno));
+}
+
+
+/*
+ * Pin receive and output thread to the cpu
+ */
+static void pincpu(int cpu)
+{
+    cpu_set_t cpus;
+    int rc;
+
+    if (sched_getaffinity(0, sizeof(allcpus), &allcpus) == 0)
+        pinned = 1;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+
+    if ((rc = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)))
+        logger(LOG_ERR, "cannot pin to cpu %d: %s", cpu, strerror(rc));
+}
+
+
+static int vbansocket(int port, int reuseport, int busypoll)
+{
+    struct sockaddr_in addr;
+    int vbsock, optval;
 
     // create UDP (vban) listen socket
     vbsock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
@@ -308,17 +568,16 @@ int main(int argc, char **argv)
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
     addr.sin_port = htons((unsigned short)port);
 
+    // set SO_REUSEPORT, kernel steers each flow to one socket
+    optval = 1;
+    if (reuseport && setsockopt(vbsock, SOL_SOCKET, SO_REUSEPORT,
+                                (const void *)&optval, sizeof(optval)) < 0)
+        error("setsockopt failed", errno);
+
     // bind
     if (bind(vbsock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
         error("bind", errno);
 
-    // set receive timeout
-    timeout.tv_sec = STREAM_TIMEOUT_MSEC / 1000000;
-    timeout.tv_usec = (STREAM_TIMEOUT_MSEC % 100000) * 1000;
-    if (setsockopt(vbsock, SOL_SOCKET, SO_RCVTIMEO, &timeout,
-                   sizeof(timeout)) < 0)
-        error("setsockopt failed", errno);
-
     // set SO_TIMESTAMPNS
     optval = 1;
     if (setsockopt(vbsock, SOL_SOCKET, SO_TIMESTAMPNS, &optval,
@@ -331,6 +590,290 @@ int main(int argc, char **argv)
                    sizeof(optval)) < 0)
         error("setsockopt failed", errno);
 
+    // set SO_RXQ_OVFL, report socket queue overflows
+    optval = 1;
+    if (setsockopt(vbsock, SOL_SOCKET, SO_RXQ_OVFL, &optval,
+                   sizeof(optval)) < 0)
+        error("setsockopt failed", errno);
+
+    // set SO_BUSY_POLL, spin on device queue instead of sleeping
+    if (busypoll > 0) {
+        optval = busypoll;
+        if (setsockopt(vbsock, SOL_SOCKET, SO_BUSY_POLL, &optval,
+                       sizeof(optval)) < 0)
+            logger(LOG_ERR, "setsockopt(SO_BUSY_POLL) failed: %s", strerror(errno));
+#ifdef SO_PREFER_BUSY_POLL
+        optval = 1;
+        if (setsockopt(vbsock, SOL_SOCKET, SO_PREFER_BUSY_POLL, &optval,
+                       sizeof(optval)) < 0)
+            logger(LOG_ERR, "setsockopt(SO_PREFER_BUSY_POLL) failed: %s", strerror(errno));
+#endif
+    }
+
+    return vbsock;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_in addr;
+    int vbsocks[INPUT_WORKERS_MAX];
+    int httpdsock;
+    int port, optval, opt, i;
+    int batch = INPUT_BATCH_DEFAULT;
+    int workers = 0;
+    int engine = INPUT_ENGINE_MMSG;
+    int gro = 0;
+    int busypoll = 0;
+    int rtprio = 0;
+    int cpu = -1;
+    int hugepages = 0;
+    int zerocopy = 0;
+    long pipesize = 0;
+    double threshold = -INFINITY;
+    struct session *session;
+    char *extra[WRITER_TARGETS_MAX];
+    int nextra = 0;
+    char *route;
+    char *prog = argv[0];
+
+    logger_init();
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGCHLD, SIG_IGN);
+
+    // parse options
+    while ((opt = getopt(argc, argv, "b:B:c:C:d:e:f:gHj:k:l:p:r:s:S:t:T:w:x:z")) != -1) {
+        switch (opt) {
+            case 'b':
+                batch = atoi(optarg);
+                if (batch < 1 || batch > INPUT_BATCH_MAX) {
+                    logger(LOG_ERR, "bad batch size: %s", optarg);
+                    return 1;
+                }
+                break;
+            case 'B':
+                busypoll = atoi(optarg);
+                if (busypoll <= 0) {
+                    logger(LOG_ERR, "bad busy poll time: %s", optarg);
+                    return 1;
+                }
+                break;
+            case 'c':
+                cpu = atoi(optarg);
+                if (cpu < 0 || cpu >= CPU_SETSIZE) {
+                    logger(LOG_ERR, "bad cpu: %s", optarg);
+                    return 1;
+                }
+                break;
+            case 'C':
+                policy = conceal_policy(optarg);
+                if (policy < 0) {
+                    logger(LOG_ERR, "bad concealment policy: %s", optarg);
+                    return 1;
+                }
+                break;
+            case 'd':
+                drift = atol(optarg);
+                if (drift <= 0) {
+                    logger(LOG_ERR, "bad drift compensation level: %s", optarg);
+                    return 1;
+                }
+                break;
+            case 'e':
+                if (!strcmp(optarg, "mmsg"))
+                    engine = INPUT_ENGINE_MMSG;
+                else
+                if (!strcmp(optarg, "uring"))
+                    engine = INPUT_ENGINE_URING;
+                else {
+                    logger(LOG_ERR, "bad receive engine: %s", optarg);
+                    return 1;
+                }
+                break;
+            case 'f':
+                format = vban_format(optarg);
+                if (format < 0) {
+                    logger(LOG_ERR, "bad sample format: %s", optarg);
+                    return 1;
+                }
+                break;
+            case 'g':
+                gro = 1;
+                break;
+            case 'H':
+                hugepages = 1;
+                break;
+            case 'j':
+                workers = atoi(optarg);
+                if (workers < 0 || workers > INPUT_WORKERS_MAX) {
+                    logger(LOG_ERR, "bad workers count: %s", optarg);
+                    return 1;
+                }
+                break;
+            case 'k':
+                timeout_k = atof(optarg);
+                if (timeout_k <= 0) {
+                    logger(LOG_ERR, "bad timeout factor: %s", optarg);
+                    return 1;
+                }
+                break;
+            case 'l':
+                latency = atol(optarg);
+                if (latency <= 0) {
+                    logger(LOG_ERR, "bad latency: %s", optarg);
+                    return 1;
+                }
+                break;
+            case 'p':
+                pipesize = atol(optarg);
+                if (pipesize <= 0) {
+                    logger(LOG_ERR, "bad pipe size: %s", optarg);
+                    return 1;
+                }
+                break;
+            case 'r':
+                rtprio = atoi(optarg);
+                if (rtprio < sched_get_priority_min(SCHED_FIFO) ||
+                    rtprio > sched_get_priority_max(SCHED_FIFO)) {
+                    logger(LOG_ERR, "bad realtime priority: %s", optarg);
+                    return 1;
+                }
+                break;
+            case 's':
+                silent_secs = atol(optarg);
+                if (silent_secs < 0) {
+                    logger(LOG_ERR, "bad silence time: %s", optarg);
+                    return 1;
+                }
+                break;
+            case 't':
+                threshold = atof(optarg);
+                if (threshold > 0) {
+                    logger(LOG_ERR, "bad silence threshold: %s", optarg);
+                    return 1;
+                }
+                break;
+            case 'S':
+                // route: pattern:pipe, repeat pattern for more pipes
+                route = strchr(optarg, ':');
+                if (!route || route == optarg || !route[1]) {
+                    logger(LOG_ERR, "bad route: %s", optarg);
+                    return 1;
+                }
+                *route++ = '\0';
+                if (!(session = session_add(optarg)) || session_pipe(session, route) < 0)
+                    return 1;
+                break;
+            case 'T':
+                if (nextra >= WRITER_TARGETS_MAX - 1) {
+                    logger(LOG_ERR, "too many pipes: %s", optarg);
+                    return 1;
+                }
+                extra[nextra++] = optarg;
+                break;
+            case 'w':
+                i = atoi(optarg);
+                if (i < 1 || i > STREAM_WINDOW_MAX) {
+                    logger(LOG_ERR, "bad reorder window: %s", optarg);
+                    return 1;
+                }
+                streamswindow(i);
+                break;
+            case 'x':
+                correlation = atof(optarg);
+                if (correlation <= 0 || correlation > 1) {
+                    logger(LOG_ERR, "bad correlation confidence: %s", optarg);
+                    return 1;
+                }
+                break;
+            case 'z':
+                zerocopy = 1;
+                break;
+            default:
+                usage(prog);
+        }
+    }
+
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    // check command line arguments
+    if (argc < 3)
+        usage(prog);
+
+    // parse port
+    port = atoi(argv[1]);
+    if (port <= 0 || port > 65535) {
+        logger(LOG_ERR, "bad port: %s", argv[1]);
+        return 1;
+    }
+
+    // default session takes streams no route matched, "-" for none
+    if (strcmp(argv[2], "-")) {
+        if (!(session = session_add("*")) || session_pipe(session, argv[2]) < 0)
+            return 1;
+
+        for (i = 0; i < nextra; i++)
+            if (session_pipe(session, extra[i]) < 0)
+                return 1;
+    } else
+    if (nextra) {
+        logger(LOG_ERR, "extra pipes need the default pipe");
+        return 1;
+    }
+
+    if (!sessions)
+        usage(prog);
+
+    // connect/disconnect handlers
+
+    if (argc > 3 && !(onconnect = strdup(argv[3])))
+        error("strdup", ENOMEM);
+
+    if (argc > 4 && !(ondisconnect = strdup(argv[4])))
+        error("strdup", ENOMEM);
+
+    // pipe output, tee() shares pages between pipes
+    for (session = sessions; session; session = session->next)
+        if (zerocopy && session->npipes > 1) {
+            logger(LOG_ERR, "zero-copy output needs a single pipe");
+            return 1;
+        }
+
+    if (writer_init(zerocopy, pipesize) < 0)
+        return 1;
+
+    // silence detection kernels
+    if (silence_init(threshold) < 0)
+        return 1;
+
+    // sample format conversion kernels
+    if (convert_init() < 0)
+        return 1;
+
+    // drift compensation resampler
+    if (drift && resample_init() < 0)
+        return 1;
+
+    // cross-correlation sync thread
+    if (correlation > 0 && xcorr_init() < 0)
+        return 1;
+
+    // create UDP (vban) listen sockets, one per receive worker
+    for (i = 0; i < (workers ? workers : 1); i++)
+        vbsocks[i] = vbansocket(port, workers > 0, busypoll);
+
+    // receive workers inherit realtime priority
+    if (rtprio)
+        realtime(rtprio);
+
+    // packet buffers and batched receive
+    pool_init(hugepages);
+
+    if (input_init(vbsocks, workers ? workers : 1, workers, engine, gro, batch) < 0)
+        error("input init", EINVAL);
+
     // create TCP (httpd) listen socket
     httpdsock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (httpdsock < 0)
@@ -357,27 +900,29 @@ int main(int argc, char **argv)
         error("listen", errno);
 
     // start httpd server
-    if (httpd(httpdsock) < 0)
+    if (httpd(httpdsock, cpu) < 0)
         error("httpd start", errno);
 
-    // vban receive loop
-    while (1) {
-        run(vbsock);
+    // pin after all other threads are started
+    if (cpu >= 0)
+        pincpu(cpu);
 
-        // disconnect all streams
-        if (streams) {
-            forgetstreams();
+    // streams expiration timer, same clock as packet timestamps
+    tfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (tfd < 0)
+        error("timerfd_create", errno);
 
-            if (output_done() < 0)
-                error("pipe close", errno);
+    // vban receive loop
+    if (loop_init() < 0 ||
+        loop_add(input_fd(), EPOLLIN, onreceive, NULL) < 0 ||
+        loop_add(tfd, EPOLLIN, onexpire, NULL) < 0)
+        error("event loop init", errno);
 
-            if (ondisconnect)
-                runhook(ondisconnect);
+    // main thread never blocks in recv, spin in epoll_wait() instead
+    if (busypoll > 0 && !workers)
+        loop_busypoll(busypoll);
 
-            // update streams stats
-            httpd_update(NULL);
-        }
-    }
+    loop_run();
 
-    return 0;
+    return 1;
 }
@@ -0,0 +1,782 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#define _GNU_SOURCE
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#include "writer.h"
+#include "logger.h"
+
+// ring size and pipe options, common to all writers
+static size_t size = WRITER_RING_SIZE;
+static size_t reserve = 0;     // bytes behind tail still referenced by the pipe
+static int zerocopy = 0;
+static long pipesize = 0;
+static int nullfd = -1;        // drains fan-out pipes
+
+// output pipes
+struct target {
+    char *path;
+    int fd;
+    int failed;                // open or write failed, retry later
+    int splice;                // vmsplice() to this pipe
+    int ready;                 // takes current chunk
+    int lagging;               // consumer too slow, reported once per open
+    int pipe;                  // fill level can be measured
+    int64_t retry;
+    size_t skew;               // bytes missing after a short write
+};
+
+struct writer {
+    // single producer (receive thread), single consumer (writer) byte ring
+    char *ring;
+    size_t head;               // written by producer
+    size_t tail;               // written by writer
+
+    struct target targets[WRITER_TARGETS_MAX];
+    int ntargets;
+
+    // fan-out: chunk goes to internal pipe once, tee() to every target
+    int fan[2];
+    size_t fansize;
+    size_t fanleft;            // bytes a failed drain left in the internal pipe
+
+    // requests from receive thread
+    int want_open;
+    int stop;
+
+    // writer wakeup
+    int efd;
+    int waiting;
+
+    pthread_t thread;
+
+    // unread bytes in the first pipe before the last write, -1 unknown
+    int measure;
+    long pipefill;
+
+    long dropped;
+    long short_writes;
+};
+
+
+/*
+ * Wake up writer if it is sleeping
+ */
+static void wakeup(struct writer *w)
+{
+    uint64_t one = 1;
+
+    if (__atomic_exchange_n(&w->waiting, 0, __ATOMIC_SEQ_CST))
+        if (write(w->efd, &one, sizeof(one)) < 0)
+            logger(LOG_ERR, "eventfd write: %s", strerror(errno));
+}
+
+
+static int64_t now_msec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/*
+ * Pipe size setup for a freshly opened pipe, returns 1 if pipe buffers
+ * may reference ring pages (vmsplice), 0 for plain writes
+ */
+static int setup(struct writer *w, struct target *t)
+{
+    long cur;
+
+    if (pipesize && fcntl(t->fd, F_SETPIPE_SZ, pipesize) < 0)
+        logger(LOG_ERR, "<out> cannot set pipe size %ld: %s", pipesize, strerror(errno));
+
+    // tee() shares pages between pipes, fan-out always copies once
+    if (!zerocopy || w->ntargets > 1)
+        return 0;
+
+    // pipe must not hold more than the reserved part of the ring
+    cur = fcntl(t->fd, F_GETPIPE_SZ);
+    if (cur < 0) {
+        logger(LOG_ERR, "<out> not a pipe, zero-copy disabled: %s", t->path);
+        return 0;
+    }
+
+    if (cur > (long) reserve)
+        cur = fcntl(t->fd, F_SETPIPE_SZ, (long) reserve);
+
+    if (cur < 0 || cur > (long) reserve) {
+        logger(LOG_ERR, "<out> pipe larger than %zu bytes, zero-copy disabled", reserve);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+static void target_open(struct writer *w, struct target *t)
+{
+    t->fd = open(t->path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+
+    if (t->fd < 0) {
+        // no reader yet, try again later
+        if (!t->failed)
+            logger(LOG_ERR, "<out> open failed: %s: %s", t->path, strerror(errno));
+        t->failed = 1;
+        t->retry = now_msec() + WRITER_RETRY_MSEC;
+        return;
+    }
+
+    if (t->failed)
+        logger(LOG_INF, "<out> pipe reopened: %s", t->path);
+    else
+        logger(LOG_INF, "<out> end of silence, pipe opened: %s", t->path);
+
+    t->failed = 0;
+    t->lagging = 0;
+    t->skew = 0;
+    t->pipe = fcntl(t->fd, F_GETPIPE_SZ) >= 0;
+    t->splice = setup(w, t);
+}
+
+
+static void target_close(struct target *t)
+{
+    close(t->fd);
+    t->fd = -1;
+    t->ready = 0;
+}
+
+
+/*
+ * Reader gone, reopen later
+ */
+static void target_fail(struct target *t, const char *what)
+{
+    logger(LOG_ERR, "<out> %s failed: %s: %s", what, t->path, strerror(errno));
+    target_close(t);
+    t->failed = 1;
+    t->retry = now_msec() + WRITER_RETRY_MSEC;
+}
+
+
+/*
+ * Ring content from pos, up to two segments
+ */
+static int segments(struct writer *w, struct iovec *iov, size_t pos, size_t len)
+{
+    size_t off = pos & (size - 1);
+
+    iov[0].iov_base = w->ring + off;
+    iov[0].iov_len = len < size - off ? len : size - off;
+    iov[1].iov_base = w->ring;
+    iov[1].iov_len = len - iov[0].iov_len;
+
+    return iov[1].iov_len ? 2 : 1;
+}
+
+
+/*
+ * Hand ring data over to the pipe: vmsplice() maps ring pages into the
+ * pipe. Never gifted, ring pages are rewritten once it wraps
+ */
+static ssize_t put(int fd, struct iovec *iov, int iovcnt, int splice)
+{
+    if (!splice)
+        return writev(fd, iov, iovcnt);
+
+    return vmsplice(fd, iov, iovcnt, SPLICE_F_NONBLOCK);
+}
+
+
+/*
+ * Single pipe: write ring content directly, returns bytes written,
+ * 0 if pipe is full, -1 on error
+ */
+static ssize_t direct(struct writer *w, struct target *t, size_t len)
+{
+    struct iovec iov[2];
+    ssize_t n;
+
+    do
+        n = put(t->fd, iov, segments(w, iov, w->tail, len), t->splice);
+    while (n < 0 && errno == EINTR);
+
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        t->ready = 0;
+        return 0;
+    }
+
+    if (n < 0) {
+        target_fail(t, "write");
+        return -1;
+    }
+
+    if ((size_t) n < len)
+        __atomic_store_n(&w->short_writes, w->short_writes + 1, __ATOMIC_RELAXED);
+
+    t->ready = 1;
+
+    return n;
+}
+
+
+/*
+ * Free space in target pipe, unlimited for regular files
+ */
+static size_t space(struct target *t)
+{
+    long cap = fcntl(t->fd, F_GETPIPE_SZ);
+    int unread;
+
+    if (cap < 0 || ioctl(t->fd, FIONREAD, &unread) < 0)
+        return SIZE_MAX;
+
+    return unread < cap ? cap - unread : 0;
+}
+
+
+/*
+ * Keep frames aligned after a short write: fill missing bytes with zeros,
+ * -1 if target failed
+ */
+static int pad(struct target *t)
+{
+    static const char zeros[4096];
+    ssize_t n;
+
+    while (t->skew) {
+        n = write(t->fd, zeros, t->skew < sizeof(zeros) ? t->skew : sizeof(zeros));
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+
+        if (n < 0) {
+            target_fail(t, "write");
+            return -1;
+        }
+
+        t->skew -= n;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Drop len bytes from the internal pipe, returns bytes left in it
+ */
+static size_t fan_drain(struct writer *w, size_t len)
+{
+    char scratch[4096];
+    ssize_t n;
+
+    while (len > 0) {
+        n = splice(w->fan[0], NULL, nullfd, NULL, len, SPLICE_F_NONBLOCK);
+
+        // read it out instead
+        if (n <= 0)
+            n = read(w->fan[0], scratch, len < sizeof(scratch) ? len : sizeof(scratch));
+
+        if (n <= 0) {
+            logger(LOG_ERR, "<out> fan-out pipe drain failed: %s", strerror(errno));
+            break;
+        }
+
+        len -= n;
+    }
+
+    return len;
+}
+
+
+/*
+ * Several pipes: copy a chunk into the internal pipe, tee() it to every
+ * target with room for it and drop the original. A full pipe loses the
+ * chunk, others go on. Returns bytes consumed, 0 if all pipes are full
+ */
+static ssize_t fanout(struct writer *w, size_t len)
+{
+    struct iovec iov[2];
+    ssize_t n, done;
+    int i, ready = 0;
+
+    if (len > w->fansize)
+        len = w->fansize;
+
+    for (i = 0; i < w->ntargets; i++) {
+        struct target *t = &w->targets[i];
+
+        t->ready = t->fd >= 0 && pad(t) == 0 && !t->skew && space(t) >= len;
+        ready += t->ready;
+    }
+
+    if (!ready)
+        return 0;
+
+    // old data would be tee()d ahead of the chunk, drop the chunk instead
+    if (w->fanleft && (w->fanleft = fan_drain(w, w->fanleft))) {
+        __atomic_fetch_add(&w->dropped, (long) len, __ATOMIC_RELAXED);
+        return len;
+    }
+
+    // internal pipe is empty and holds the whole chunk
+    do
+        n = writev(w->fan[1], iov, segments(w, iov, w->tail, len));
+    while (n < 0 && errno == EINTR);
+
+    if (n <= 0) {
+        logger(LOG_ERR, "<out> fan-out pipe write failed: %s", strerror(errno));
+        __atomic_fetch_add(&w->dropped, (long) len, __ATOMIC_RELAXED);
+        return len;
+    }
+
+    len = n;
+
+    for (i = 0; i < w->ntargets; i++) {
+        struct target *t = &w->targets[i];
+
+        if (t->fd < 0)
+            continue;
+
+        if (!t->ready) {
+            if (!t->lagging)
+                logger(LOG_ERR, "<out> pipe too slow, dropping data: %s", t->path);
+            t->lagging = 1;
+            __atomic_fetch_add(&w->dropped, (long) len, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        n = tee(w->fan[0], t->fd, len, SPLICE_F_NONBLOCK);
+
+        if (n < 0 && errno != EAGAIN) {
+            target_fail(t, "tee");
+            continue;
+        }
+
+        // pipe slots ran out: copy the rest, zeros later if it fails too
+        if (n < (ssize_t) len) {
+            done = n < 0 ? 0 : n;
+            n = writev(t->fd, iov, segments(w, iov, w->tail + done, len - done));
+            if (n > 0)
+                done += n;
+            t->skew = len - done;
+            __atomic_store_n(&w->short_writes, w->short_writes + 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    // drop the original, leftovers go before the next chunk
+    w->fanleft = fan_drain(w, len);
+
+    return len;
+}
+
+
+/*
+ * Writer thread: open pipes, drain the ring with writev() or vmsplice(),
+ * tee() to several pipes, close on request
+ */
+static void *writer(void *arg)
+{
+    struct writer *w = arg;
+    int blocked = 0;
+    int i;
+
+    while (!__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE)) {
+        size_t h = __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+        int open_req = __atomic_load_n(&w->want_open, __ATOMIC_ACQUIRE);
+        struct pollfd pfd[WRITER_TARGETS_MAX + 1];
+        int64_t retry = INT64_MAX;
+        uint64_t value;
+        int nfds, timeout, nopen = 0;
+        ssize_t n;
+
+        for (i = 0; i < w->ntargets; i++) {
+            struct target *t = &w->targets[i];
+
+            if (open_req && t->fd < 0 && now_msec() >= t->retry)
+                target_open(w, t);
+
+            if (!open_req && t->fd >= 0 && h == w->tail)
+                target_close(t);
+
+            if (t->fd >= 0)
+                nopen++;
+            else
+            if (open_req && t->retry < retry)
+                retry = t->retry;
+        }
+
+        if (h != w->tail && !nopen) {
+            // nowhere to write
+            __atomic_fetch_add(&w->dropped, (long) (h - w->tail), __ATOMIC_RELAXED);
+            __atomic_store_n(&w->tail, h, __ATOMIC_RELEASE);
+            blocked = 0;
+            continue;
+        }
+
+        if (h != w->tail && !blocked) {
+            if (__atomic_load_n(&w->measure, __ATOMIC_RELAXED)) {
+                struct target *t = &w->targets[0];
+                int unread = -1;
+
+                if (t->fd < 0 || !t->pipe || ioctl(t->fd, FIONREAD, &unread) < 0)
+                    unread = -1;
+
+                __atomic_store_n(&w->pipefill, (long) unread, __ATOMIC_RELAXED);
+            }
+
+            if (w->ntargets > 1)
+                n = fanout(w, h - w->tail);
+            else
+                n = direct(w, &w->targets[0], h - w->tail);
+
+            if (n > 0)
+                __atomic_store_n(&w->tail, w->tail + n, __ATOMIC_RELEASE);
+            else
+            if (n == 0)
+                blocked = 1;
+
+            continue;
+        }
+
+        // nothing to do, announce waiting and check again
+        __atomic_store_n(&w->waiting, 1, __ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(&w->stop, __ATOMIC_SEQ_CST) ||
+            __atomic_load_n(&w->want_open, __ATOMIC_SEQ_CST) != open_req ||
+            (__atomic_load_n(&w->head, __ATOMIC_SEQ_CST) != h && !blocked)) {
+            __atomic_store_n(&w->waiting, 0, __ATOMIC_SEQ_CST);
+            blocked = 0;
+            continue;
+        }
+
+        pfd[0].fd = w->efd;
+        pfd[0].events = POLLIN;
+        nfds = 1;
+
+        // wait for pipes which could not take data
+        for (i = 0; blocked && i < w->ntargets; i++)
+            if (w->targets[i].fd >= 0 && !w->targets[i].ready) {
+                pfd[nfds].fd = w->targets[i].fd;
+                pfd[nfds].events = POLLOUT;
+                nfds++;
+            }
+
+        timeout = -1;
+        if (retry != INT64_MAX)
+            timeout = (int) (retry - now_msec());
+        if (timeout < -1)
+            timeout = 0;
+
+        if (poll(pfd, nfds, timeout) < 0 && errno != EINTR)
+            logger(LOG_ERR, "poll: %s", strerror(errno));
+
+        __atomic_store_n(&w->waiting, 0, __ATOMIC_SEQ_CST);
+
+        if (read(w->efd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+            logger(LOG_ERR, "eventfd read: %s", strerror(errno));
+
+        for (i = 1; i < nfds; i++)
+            if (pfd[i].revents)
+                blocked = 0;
+    }
+
+    for (i = 0; i < w->ntargets; i++)
+        if (w->targets[i].fd >= 0)
+            target_close(&w->targets[i]);
+
+    return NULL;
+}
+
+
+/*
+ * Configure pipe output: zero-copy vmsplice() and pipe buffer size,
+ * pipesize 0 keeps the system default
+ */
+int writer_init(int splice, long bytes)
+{
+    long want = bytes > WRITER_RING_SIZE ? bytes : WRITER_RING_SIZE;
+
+    zerocopy = splice;
+    pipesize = bytes;
+
+    // power of two, big enough for the whole pipe
+    for (size = WRITER_RING_SIZE; (long) size < want; size <<= 1);
+
+    // with vmsplice() the pipe keeps up to its size of spliced data
+    // referenced, that part of the ring cannot be reused until drained
+    if (zerocopy) {
+        reserve = size;
+        size <<= 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Internal pipe for fan-out and /dev/null to drain it
+ */
+static int fan_init(struct writer *w)
+{
+    long cur;
+
+    if (pipe2(w->fan, O_NONBLOCK | O_CLOEXEC) < 0) {
+        logger(LOG_ERR, "pipe: %s", strerror(errno));
+        return -1;
+    }
+
+    if (nullfd < 0)
+        nullfd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+    if (nullfd < 0) {
+        logger(LOG_ERR, "open failed: /dev/null: %s", strerror(errno));
+        return -1;
+    }
+
+    if (pipesize && fcntl(w->fan[1], F_SETPIPE_SZ, pipesize) < 0)
+        logger(LOG_ERR, "<out> cannot set pipe size %ld: %s", pipesize, strerror(errno));
+
+    cur = fcntl(w->fan[1], F_GETPIPE_SZ);
+    w->fansize = cur > 0 ? cur : WRITER_RING_SIZE;
+
+    return 0;
+}
+
+
+/*
+ * Release writer resources, thread must not be running
+ */
+static void writer_free(struct writer *w)
+{
+    int i;
+
+    for (i = 0; i < w->ntargets; i++)
+        free(w->targets[i].path);
+
+    if (w->fan[0] >= 0)
+        close(w->fan[0]);
+
+    if (w->fan[1] >= 0)
+        close(w->fan[1]);
+
+    if (w->efd >= 0)
+        close(w->efd);
+
+    // pages still referenced by a pipe stay alive until it is drained,
+    // fresh writers never rewrite them
+    if (w->ring)
+        munmap(w->ring, size);
+
+    free(w);
+}
+
+
+/*
+ * Start writer thread for the pipes, NULL on failure
+ */
+struct writer *writer_start(const char **filenames, int count)
+{
+    struct sched_param param;
+    pthread_attr_t attr;
+    struct writer *w;
+    int i, rc;
+
+    w = calloc(1, sizeof(struct writer));
+    if (!w) {
+        logger(LOG_ERR, "cannot allocate memory!");
+        return NULL;
+    }
+
+    w->fan[0] = -1;
+    w->fan[1] = -1;
+    w->efd = -1;
+    w->pipefill = -1;
+
+    w->ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (w->ring == MAP_FAILED) {
+        w->ring = NULL;
+        logger(LOG_ERR, "cannot allocate memory!");
+        writer_free(w);
+        return NULL;
+    }
+
+    w->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (w->efd < 0) {
+        logger(LOG_ERR, "eventfd: %s", strerror(errno));
+        writer_free(w);
+        return NULL;
+    }
+
+    if (count > 1 && fan_init(w) < 0) {
+        writer_free(w);
+        return NULL;
+    }
+
+    for (i = 0; i < count && i < WRITER_TARGETS_MAX; i++) {
+        struct target *t = &w->targets[w->ntargets];
+
+        t->fd = -1;
+
+        if (!(t->path = strdup(filenames[i]))) {
+            logger(LOG_ERR, "cannot allocate memory!");
+            writer_free(w);
+            return NULL;
+        }
+
+        w->ntargets++;
+    }
+
+    if ((rc = pthread_attr_init(&attr))) {
+        logger(LOG_ERR, "pthread_attr_init failed: %s", strerror(rc));
+        writer_free(w);
+        return NULL;
+    }
+
+    // never inherit realtime priority
+    param.sched_priority = 0;
+    if ((rc = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED)) ||
+        (rc = pthread_attr_setschedpolicy(&attr, SCHED_OTHER)) ||
+        (rc = pthread_attr_setschedparam(&attr, &param))) {
+        logger(LOG_ERR, "pthread_attr_setsched failed: %s", strerror(rc));
+        writer_free(w);
+        return NULL;
+    }
+
+    if ((rc = pthread_create(&w->thread, &attr, writer, w))) {
+        logger(LOG_ERR, "pthread_create failed: %s", strerror(rc));
+        writer_free(w);
+        return NULL;
+    }
+
+    return w;
+}
+
+
+/*
+ * Stop writer thread, close the pipes and free the writer
+ */
+void writer_stop(struct writer *w)
+{
+    if (!w)
+        return;
+
+    __atomic_store_n(&w->stop, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&w->waiting, 1, __ATOMIC_SEQ_CST);
+    wakeup(w);
+
+    pthread_join(w->thread, NULL);
+    writer_free(w);
+}
+
+
+/*
+ * Request pipe open or close, pipe is closed after pending data is written
+ */
+void writer_open(struct writer *w, int open)
+{
+    __atomic_store_n(&w->want_open, open, __ATOMIC_SEQ_CST);
+    wakeup(w);
+}
+
+
+/*
+ * Queue data for the pipe, whole block or nothing: 0 on success,
+ * -1 if ring is full
+ */
+int writer_put(struct writer *w, const struct iovec *iov, int iovcnt)
+{
+    size_t len = 0, off;
+    int i;
+
+    for (i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+
+    if (size - reserve - (w->head - __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE)) < len) {
+        __atomic_fetch_add(&w->dropped, (long) len, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    for (i = 0, off = w->head; i < iovcnt; i++) {
+        size_t pos = off & (size - 1);
+        size_t part = size - pos;
+
+        if (part > iov[i].iov_len)
+            part = iov[i].iov_len;
+
+        memcpy(w->ring + pos, iov[i].iov_base, part);
+        memcpy(w->ring, (char *) iov[i].iov_base + part, iov[i].iov_len - part);
+        off += iov[i].iov_len;
+    }
+
+    __atomic_store_n(&w->head, off, __ATOMIC_RELEASE);
+    wakeup(w);
+
+    return 0;
+}
+
+
+/*
+ * Bytes queued for the first pipe reader: ring backlog and pipe content,
+ * -1 if unknown. First call starts measurements
+ */
+long writer_fill(struct writer *w)
+{
+    long fill;
+
+    if (!__atomic_exchange_n(&w->measure, 1, __ATOMIC_RELAXED))
+        return -1;
+
+    fill = __atomic_load_n(&w->pipefill, __ATOMIC_RELAXED);
+    if (fill < 0)
+        return -1;
+
+    return fill + (long) (w->head - __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE));
+}
+
+
+void writer_stats(struct writer *w, struct writer_stats *stats)
+{
+    stats->dropped = __atomic_load_n(&w->dropped, __ATOMIC_RELAXED);
+    stats->short_writes = __atomic_load_n(&w->short_writes, __ATOMIC_RELAXED);
+}
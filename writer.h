@@ -0,0 +1,51 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#ifndef _WRITER_H
+#define _WRITER_H 1
+
+#include <sys/uio.h>
+
+/*
+ * Pipe writer thread
+ */
+
+#define WRITER_RING_SIZE (1 << 16)
+#define WRITER_RETRY_MSEC 1000
+#define WRITER_TARGETS_MAX 8
+
+struct writer_stats {
+    long dropped;              // bytes dropped: ring full, pipe unavailable or too slow
+    long short_writes;         // partial writes, remainder written later
+};
+
+struct writer;
+
+int writer_init(int splice, long pipesize);
+struct writer *writer_start(const char **filenames, int count);
+void writer_stop(struct writer *w);
+void writer_open(struct writer *w, int open);
+int writer_put(struct writer *w, const struct iovec *iov, int iovcnt);
+long writer_fill(struct writer *w);
+void writer_stats(struct writer *w, struct writer_stats *stats);
+
+#endif
@@ -0,0 +1,393 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <math.h>
+
+#include "xcorr.h"
+#include "sample.h"
+#include "logger.h"
+
+// decimated window and fft size, zero padded for linear correlation
+#define XCORR_COARSE (XCORR_WINDOW / XCORR_DECIMATE)
+#define XCORR_FFT (2 * XCORR_COARSE)
+
+// single job, owned by main thread when idle, by worker when pending
+enum { XCORR_IDLE, XCORR_PENDING, XCORR_DONE };
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int state = XCORR_IDLE;
+static int enabled = 0;
+static uint64_t tokens = 0;
+
+static struct xcorr_result job;
+static float a[XCORR_WINDOW];  // primary, mono
+static float b[XCORR_WINDOW];  // backup, mono
+
+// fft buffers
+static double re1[XCORR_FFT], im1[XCORR_FFT];
+static double re2[XCORR_FFT], im2[XCORR_FFT];
+
+
+/*
+ * In-place iterative radix-2 complex fft, n is a power of two
+ */
+static void fft(double *re, double *im, long n, int inverse)
+{
+    long i, j, k, len, bit;
+    double t;
+
+    for (i = 1, j = 0; i < n; i++) {
+        for (bit = n >> 1; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+
+        if (i < j) {
+            t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+
+    for (len = 2; len <= n; len <<= 1) {
+        double ang = (inverse ? 2.0 : -2.0) * M_PI / len;
+        double wr = cos(ang), wi = sin(ang);
+
+        for (i = 0; i < n; i += len) {
+            double cr = 1.0, ci = 0.0;
+
+            for (k = 0; k < len / 2; k++) {
+                long p = i + k, q = i + k + len / 2;
+                double vr = re[q] * cr - im[q] * ci;
+                double vi = re[q] * ci + im[q] * cr;
+
+                re[q] = re[p] - vr;
+                im[q] = im[p] - vi;
+                re[p] += vr;
+                im[p] += vi;
+
+                t = cr * wr - ci * wi;
+                ci = cr * wi + ci * wr;
+                cr = t;
+            }
+        }
+    }
+}
+
+
+/*
+ * Box filter and decimate window into fft buffer, remove dc, zero pad
+ */
+static void decimate(const float *x, double *re, double *im)
+{
+    double mean = 0;
+    long i, j;
+
+    for (i = 0; i < XCORR_COARSE; i++) {
+        double sum = 0;
+
+        for (j = 0; j < XCORR_DECIMATE; j++)
+            sum += x[i * XCORR_DECIMATE + j];
+
+        re[i] = sum / XCORR_DECIMATE;
+        mean += re[i];
+    }
+
+    mean /= XCORR_COARSE;
+
+    for (i = 0; i < XCORR_COARSE; i++)
+        re[i] -= mean;
+
+    memset(re + XCORR_COARSE, 0, sizeof(double) * (XCORR_FFT - XCORR_COARSE));
+    memset(im, 0, sizeof(double) * XCORR_FFT);
+}
+
+
+/*
+ * Normalized correlation of a[i] and b[i + lag] over their overlap
+ */
+static double correlate(long lag)
+{
+    double ab = 0, aa = 0, bb = 0;
+    long i, from = lag < 0 ? -lag : 0, to = lag > 0 ? XCORR_WINDOW - lag : XCORR_WINDOW;
+
+    for (i = from; i < to; i++) {
+        ab += (double) a[i] * b[i + lag];
+        aa += (double) a[i] * a[i];
+        bb += (double) b[i + lag] * b[i + lag];
+    }
+
+    if (aa <= 0 || bb <= 0)
+        return 0;
+
+    return ab / sqrt(aa * bb);
+}
+
+
+// correlation at coarse lag, negative lags wrap around
+#define R(lag) re1[((lag) + XCORR_FFT) % XCORR_FFT]
+
+
+/*
+ * Find lag of b relative to a: coarse search on decimated signals with
+ * fft, refine at full rate around the peak. Returns confidence
+ */
+static double search(long *lag)
+{
+    long i, best = 0, coarse, l;
+    double c, peak, second = 0, conf = -1;
+
+    decimate(a, re1, im1);
+    decimate(b, re2, im2);
+
+    fft(re1, im1, XCORR_FFT, 0);
+    fft(re2, im2, XCORR_FFT, 0);
+
+    // conj(A) * B
+    for (i = 0; i < XCORR_FFT; i++) {
+        double r = re1[i] * re2[i] + im1[i] * im2[i];
+        double m = re1[i] * im2[i] - im1[i] * re2[i];
+
+        re1[i] = r;
+        im1[i] = m;
+    }
+
+    fft(re1, im1, XCORR_FFT, 1);
+
+    // lags up to half of the window, negative lags wrap around
+    for (i = -XCORR_COARSE / 2; i <= XCORR_COARSE / 2; i++)
+        if (R(i) > R(best))
+            best = i;
+
+    peak = R(best);
+    if (peak <= 0)
+        return 0;
+
+    // highest other local maximum, periodic signals have many alike
+    for (i = -XCORR_COARSE / 2 + 1; i < XCORR_COARSE / 2; i++)
+        if (i != best && R(i) >= R(i - 1) && R(i) >= R(i + 1) && R(i) > second)
+            second = R(i);
+
+    if (second > XCORR_AMBIGUITY * peak)
+        return 0;
+
+    coarse = best * XCORR_DECIMATE;
+    for (l = coarse - XCORR_DECIMATE; l <= coarse + XCORR_DECIMATE; l++) {
+        c = correlate(l);
+        if (c > conf) {
+            conf = c;
+            *lag = l;
+        }
+    }
+
+    return conf > 0 ? conf : 0;
+}
+
+
+static void *worker(void *arg)
+{
+    long lag = 0;
+    double conf;
+
+    while (1) {
+        pthread_mutex_lock(&lock);
+        while (state != XCORR_PENDING)
+            pthread_cond_wait(&cond, &lock);
+        pthread_mutex_unlock(&lock);
+
+        conf = search(&lag);
+
+        pthread_mutex_lock(&lock);
+        job.offset += lag;
+        job.confidence = conf;
+        state = XCORR_DONE;
+        pthread_mutex_unlock(&lock);
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Start correlation thread, streams record mono history from now on
+ */
+int xcorr_init(void)
+{
+    struct sched_param param;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int rc;
+
+    if ((rc = pthread_attr_init(&attr))) {
+        logger(LOG_ERR, "pthread_attr_init failed: %s", strerror(rc));
+        return -1;
+    }
+
+    // never inherit realtime priority
+    param.sched_priority = 0;
+    if ((rc = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED)) ||
+        (rc = pthread_attr_setschedpolicy(&attr, SCHED_OTHER)) ||
+        (rc = pthread_attr_setschedparam(&attr, &param)) ||
+        (rc = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED))) {
+        logger(LOG_ERR, "pthread_attr_setsched failed: %s", strerror(rc));
+        return -1;
+    }
+
+    if ((rc = pthread_create(&thread, &attr, worker, NULL))) {
+        logger(LOG_ERR, "pthread_create failed: %s", strerror(rc));
+        return -1;
+    }
+
+    enabled = 1;
+
+    return 0;
+}
+
+
+int xcorr_alloc(struct stream *stream)
+{
+    stream->xhist = NULL;
+    stream->xhist_pos = 0;
+    stream->xhist_count = 0;
+    stream->xcorr_token = 0;
+
+    if (!enabled)
+        return 0;
+
+    stream->xhist = calloc(XCORR_HISTORY, sizeof(float));
+
+    return stream->xhist ? 0 : -1;
+}
+
+
+void xcorr_free(struct stream *stream)
+{
+    free(stream->xhist);
+    stream->xhist = NULL;
+}
+
+
+/*
+ * Save packet to mono history, lost packets are zeros
+ */
+void xcorr_record(struct stream *stream, uint32_t seq, const char *data)
+{
+    int64_t pos = (int64_t) seq * stream->frames;
+    float *h = stream->xhist;
+    long i, c;
+
+    if (stream->xhist_count && pos != stream->xhist_pos) {
+        if (pos < stream->xhist_pos)
+            // late packet, its place is taken
+            return;
+
+        if (pos - stream->xhist_pos >= XCORR_HISTORY)
+            stream->xhist_count = 0;
+        else
+            for (; stream->xhist_pos < pos; stream->xhist_pos++, stream->xhist_count++)
+                h[stream->xhist_pos & (XCORR_HISTORY - 1)] = 0;
+    }
+
+    if (!stream->xhist_count)
+        stream->xhist_pos = pos;
+
+    for (i = 0; i < stream->frames; i++) {
+        double sum = 0;
+
+        for (c = 0; c < stream->channels; c++, data += stream->sample_size)
+            sum += sample_get(data, stream->format);
+
+        h[(stream->xhist_pos + i) & (XCORR_HISTORY - 1)] = sum / stream->channels;
+    }
+
+    stream->xhist_pos += stream->frames;
+    stream->xhist_count += stream->frames;
+
+    if (stream->xhist_count > XCORR_HISTORY)
+        stream->xhist_count = XCORR_HISTORY;
+}
+
+
+static void window(float *dst, struct stream *stream)
+{
+    int64_t pos = stream->xhist_pos - XCORR_WINDOW;
+    long i;
+
+    for (i = 0; i < XCORR_WINDOW; i++)
+        dst[i] = stream->xhist[(pos + i) & (XCORR_HISTORY - 1)];
+}
+
+
+/*
+ * Queue correlation of backup with primary: 0 if queued, -1 if busy or
+ * not enough history yet
+ */
+int xcorr_submit(struct stream *primary, struct stream *backup)
+{
+    if (!primary->xhist || !backup->xhist ||
+        primary->xhist_count < XCORR_WINDOW || backup->xhist_count < XCORR_WINDOW)
+        return -1;
+
+    if (__atomic_load_n(&state, __ATOMIC_ACQUIRE) != XCORR_IDLE)
+        return -1;
+
+    if (!primary->xcorr_token)
+        primary->xcorr_token = ++tokens;
+    backup->xcorr_token = ++tokens;
+
+    window(a, primary);
+    window(b, backup);
+
+    // same frame in both streams, before the lag is added
+    job.primary = primary->xcorr_token;
+    job.backup = backup->xcorr_token;
+    job.offset = backup->xhist_pos - primary->xhist_pos;
+    job.confidence = 0;
+
+    pthread_mutex_lock(&lock);
+    state = XCORR_PENDING;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+
+    return 0;
+}
+
+
+/*
+ * Take finished job result, 1 if there is one
+ */
+int xcorr_poll(struct xcorr_result *result)
+{
+    if (__atomic_load_n(&state, __ATOMIC_ACQUIRE) != XCORR_DONE)
+        return 0;
+
+    pthread_mutex_lock(&lock);
+    *result = job;
+    state = XCORR_IDLE;
+    pthread_mutex_unlock(&lock);
+
+    return 1;
+}
@@ -0,0 +1,52 @@
+/*
+ *  VBAN Receiver
+ *
+ *  Copyright (C) 2017, 2018 Raman Shyshniou <rommer@ibuffed.com>
+ *  All Rights Reserved.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#ifndef _XCORR_H
+#define _XCORR_H 1
+
+#include <stdint.h>
+#include "streams.h"
+
+/*
+ * Cross-correlation synchronization for near-identical streams
+ */
+
+#define XCORR_HISTORY (1 << 15)    // mono frames kept per stream
+#define XCORR_WINDOW (1 << 14)     // frames correlated per attempt
+#define XCORR_DECIMATE 4           // coarse search sample rate divider
+#define XCORR_AMBIGUITY 0.9        // second peak to best peak, ambiguous above
+
+struct xcorr_result {
+    uint64_t primary;          // tokens of correlated streams
+    uint64_t backup;
+    int64_t offset;            // backup offset, frames
+    double confidence;         // normalized correlation at offset, 0..1
+};
+
+int xcorr_init(void);
+int xcorr_alloc(struct stream *stream);
+void xcorr_free(struct stream *stream);
+void xcorr_record(struct stream *stream, uint32_t seq, const char *data);
+int xcorr_submit(struct stream *primary, struct stream *backup);
+int xcorr_poll(struct xcorr_result *result);
+
+#endif